@@ -0,0 +1,164 @@
+#ifndef COUNTING_SORT_H_INCLUDED
+#define COUNTING_SORT_H_INCLUDED
+#include "sort_aux.h"
+#include "scratch_arena.h"
+#include "sort_observer.h"
+#include <limits>
+
+SORTER_BEGIN
+// Declares that every value of the enumeration Tp lies in [min, max], so that qsort can
+// sort it by counting:
+//
+//     template <>
+//     struct sorter::enum_range<color>
+//     {
+//         static constexpr color min = color::red;
+//         static constexpr color max = color::blue;
+//     };
+//
+// The range may hold up to 2^16 values. A value outside of it is detected, and the range
+// is then sorted by comparisons.
+template <class Tp>
+struct enum_range {};
+
+// Maps the keys of counting_sort to the histogram slots [0, size), in ascending order.
+// Defined for the integral types of at most 16 bits and for the enumerations with an
+// enum_range; for the latter, 'checked' is set and the values out of the range map to
+// the extra slot 'size'.
+template <class Tp,
+          class = void>
+struct counting_key
+{
+    static constexpr bool enabled = false;
+};
+
+template <class Tp>
+struct counting_key<Tp, std::enable_if_t<std::is_integral<Tp>::value && sizeof(Tp) <= 2>>
+{
+    static constexpr bool enabled = true;
+    static constexpr bool checked = false;
+    static constexpr size_t size = size_t(1) << (std::is_same<Tp, bool>::value ? 1 : 8 * sizeof(Tp));
+
+    static constexpr size_t slot(Tp val) noexcept
+    { return static_cast<size_t>(static_cast<int32_t>(val) - static_cast<int32_t>(std::numeric_limits<Tp>::min())); }
+
+    static constexpr Tp value(size_t s) noexcept
+    { return static_cast<Tp>(static_cast<int32_t>(s) + static_cast<int32_t>(std::numeric_limits<Tp>::min())); }
+};
+
+template <class Tp>
+struct counting_key<Tp, std::enable_if_t<std::is_enum<Tp>::value,
+                                         std::void_t<decltype(enum_range<Tp>::min), decltype(enum_range<Tp>::max)>>>
+{
+    typedef std::underlying_type_t<Tp> underlying_type;
+    static constexpr int64_t low  = static_cast<int64_t>(static_cast<underlying_type>(enum_range<Tp>::min));
+    static constexpr int64_t high = static_cast<int64_t>(static_cast<underlying_type>(enum_range<Tp>::max));
+    static_assert(low <= high, "enum_range: min must not exceed max");
+
+    static constexpr bool enabled = static_cast<uint64_t>(high - low) < (uint64_t(1) << 16);
+    static constexpr bool checked = true;
+    static constexpr size_t size = static_cast<size_t>(high - low) + 1;
+
+    static constexpr size_t slot(Tp val) noexcept
+    {
+        const uint64_t s = static_cast<uint64_t>(static_cast<int64_t>(static_cast<underlying_type>(val)) - low);
+        return s < size ? static_cast<size_t>(s) : size;
+    }
+
+    static constexpr Tp value(size_t s) noexcept
+    { return static_cast<Tp>(static_cast<underlying_type>(low + static_cast<int64_t>(s))); }
+};
+
+// Keys that qsort sorts by counting, from counting_sort_min_len elements on. Equal keys
+// are indistinguishable with the simple comparators, so the output is just the
+// histogram written back in order.
+template <class Iter,
+          class Compare,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool use_counting_sort = counting_key<Tp>::enabled &&
+                                   std::is_trivially_copyable<Tp>::value &&
+                                   is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
+
+// Up to 256 keys the histograms live on the stack; 16-bit keys clear and sum 256 KiB of
+// counts per sub-histogram, which pays off from longer ranges.
+template <class Tp>
+INLINE_VAR constexpr ptrdiff_t counting_sort_min_len = counting_key<Tp>::size <= 256 ? 256 : 1 << 14;
+
+// Independent histograms filled in turn, so that runs of equal keys do not serialize on
+// one counter through store forwarding; summed before the write back.
+template <class Tp>
+INLINE_VAR constexpr int counting_sub_histograms = counting_key<Tp>::size <= 256 ? 4 : 2;
+
+template <class Count,
+          class Compare,
+          class RandomAccessIterator>
+bool
+counting_sort_with(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Count* hist)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef counting_key<value_type> key;
+    constexpr int subs = counting_sub_histograms<value_type>;
+    constexpr size_t stride = key::size + key::checked;
+    std::fill_n(hist, stride * subs, Count(0));
+
+    RandomAccessIterator it = first;
+    for (; last - it >= subs; it += subs)
+        for (int k = 0; k < subs; ++k)
+            ++hist[stride * k + key::slot(it[k])];
+    for (; it != last; ++it)
+        ++hist[key::slot(*it)];
+    for (int k = 1; k < subs; ++k)
+        for (size_t s = 0; s < stride; ++s)
+            hist[s] += hist[stride * k + s];
+    if (key::checked && hist[stride - 1] != 0) // a value outside the enum_range
+        return false;
+
+    if constexpr (is_greater_comparator<typename std::remove_cvref<Compare>::type>)
+        for (size_t s = key::size; s-- > 0;)
+            first = std::fill_n(first, hist[s], key::value(s));
+    else
+        for (size_t s = 0; s < key::size; ++s)
+            first = std::fill_n(first, hist[s], key::value(s));
+    return true;
+}
+
+// Sorts [first, last) by counting its keys; see use_counting_sort. Returns false, with
+// the range untouched, if an enumeration value is out of its enum_range or the
+// histograms of 16-bit keys cannot be allocated.
+template <class Compare,
+          class Observer,
+          class RandomAccessIterator>
+bool
+counting_sort(RandomAccessIterator first,
+              RandomAccessIterator last,
+              Compare&,
+              Observer& obs)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef counting_key<value_type> key;
+    constexpr size_t hist_len = (key::size + key::checked) * counting_sub_histograms<value_type>;
+    auto start = observe_start(obs);
+    bool sorted;
+    if constexpr (key::size <= 256)
+    {
+        size_t hist[hist_len];
+        sorted = counting_sort_with<size_t, Compare>(first, last, hist);
+    }
+    else
+    {
+        if (static_cast<uint64_t>(last - first) > std::numeric_limits<uint32_t>::max())
+            return false;
+        scoped_scratch scratch;
+        uint32_t* hist = scratch.allocate<uint32_t>(hist_len);
+        if (hist == nullptr)
+            return false;
+        sorted = counting_sort_with<uint32_t, Compare>(first, last, hist);
+    }
+    if (sorted)
+        observe(obs, start, sort_event::partition, last - first, static_cast<ptrdiff_t>(key::size), partition_kernel::counting);
+    return sorted;
+}
+SORTER_END
+#endif // COUNTING_SORT_H_INCLUDED
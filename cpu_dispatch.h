@@ -0,0 +1,213 @@
+#ifndef CPU_DISPATCH_H_INCLUDED
+#define CPU_DISPATCH_H_INCLUDED
+#include "sort_aux.h"
+
+// Runtime CPU dispatch of the partition and small-sort kernels. The kernels are also
+// built for AVX2 and AVX-512 and the variant is picked by cpuid, so a binary built for
+// the baseline x86-64 still uses the wider instructions where they exist.
+// -DSORTER_NO_CPU_DISPATCH keeps only the scalar (baseline) variant, e.g. to test it on
+// a machine that would otherwise pick another one.
+#if !defined(SORTER_NO_CPU_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SORTER_CPU_DISPATCH 1
+#define SORTER_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define SORTER_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,bmi,bmi2,popcnt")))
+#include <immintrin.h>
+#else
+#define SORTER_CPU_DISPATCH 0
+#endif
+
+SORTER_BEGIN
+enum class cpu_isa
+{
+    scalar, // the baseline the translation unit is built for
+    avx2,   // Haswell and later, Zen
+    avx512  // Skylake-X and later, Zen 4
+};
+
+// The widest kernel variant the running CPU supports.
+inline cpu_isa detect_cpu_isa() noexcept
+{
+#if SORTER_CPU_DISPATCH
+    __builtin_cpu_init(); // may run before the static constructors
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("bmi2"))
+        return cpu_isa::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+        return cpu_isa::avx2;
+#endif
+    return cpu_isa::scalar;
+}
+
+// detect_cpu_isa(), evaluated once per process.
+inline cpu_isa runtime_cpu_isa() noexcept
+{
+    static const cpu_isa isa = detect_cpu_isa();
+    return isa;
+}
+
+// The variant of a multi-versioned kernel for the running CPU, chosen on first use and
+// then kept for the rest of the process, so that each call costs one indirect call, as
+// with an ifunc. 'Kernels' provides the function pointer type 'function' and the static
+// members 'scalar', and with SORTER_CPU_DISPATCH also 'avx2' and 'avx512'; these usually
+// instantiate one SORTER_FORCEINLINE body, which is then compiled for each target.
+template <class Kernels>
+inline typename Kernels::function
+cpu_dispatched() noexcept
+{
+    static const typename Kernels::function kernel = []() -> typename Kernels::function {
+#if SORTER_CPU_DISPATCH
+        switch (runtime_cpu_isa())
+        {
+        case cpu_isa::avx512:
+            return &Kernels::avx512;
+        case cpu_isa::avx2:
+            return &Kernels::avx2;
+        case cpu_isa::scalar:
+            break;
+        }
+#endif
+        return &Kernels::scalar;
+    }();
+    return kernel;
+}
+
+// Vector comparison of a bitset_partition block of 64 consecutive elements against the
+// pivot, for the arithmetic types with 4- or 8-byte lanes and the simple comparators.
+template <cpu_isa Isa, class Tp, class Compare>
+struct simd_compare_block
+{
+    static constexpr bool enabled = false;
+};
+
+// Whether populate_left_bitset/populate_right_bitset use simd_compare_block.
+template <cpu_isa Isa,
+          class RandomAccessIterator,
+          class Compare,
+          class ValueType = typename std::iterator_traits<RandomAccessIterator>::value_type>
+INLINE_VAR constexpr bool use_simd_compare_block = simd_compare_block<Isa, ValueType, Compare>::enabled &&
+                                                   std::contiguous_iterator<RandomAccessIterator> &&
+                                                   tuning_of<ValueType>::value.block_size == 64;
+
+#if SORTER_CPU_DISPATCH
+template <class Tp>
+INLINE_VAR constexpr bool is_simd_lane_type =
+    (std::is_integral<Tp>::value && !std::is_same<Tp, bool>::value && (sizeof(Tp) == 4 || sizeof(Tp) == 8)) ||
+    std::is_same<Tp, float>::value || std::is_same<Tp, double>::value;
+
+// mask() returns the 64 outcomes of comp(first[j], pivot), bit j for first[j].
+template <class Tp, class Compare>
+struct simd_compare_block<cpu_isa::avx2, Tp, Compare>
+{
+    static constexpr bool enabled = is_simd_lane_type<Tp> &&
+                                    is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
+
+    SORTER_TARGET_AVX2 static inline uint64_t
+    mask(const Tp* first, Tp pivot) noexcept
+    {
+        constexpr bool greater = is_greater_comparator<typename std::remove_cvref<Compare>::type>;
+        constexpr int lanes = 32 / sizeof(Tp);
+        uint64_t bits = 0;
+        for (int j = 0; j < 64; j += lanes)
+        {
+            uint64_t m;
+            if constexpr (std::is_floating_point<Tp>::value)
+            {
+                if constexpr (sizeof(Tp) == 8)
+                {
+                    const __m256d x = _mm256_loadu_pd(first + j), p = _mm256_set1_pd(pivot);
+                    m = static_cast<unsigned>(_mm256_movemask_pd(greater ? _mm256_cmp_pd(p, x, _CMP_LT_OQ)
+                                                                         : _mm256_cmp_pd(x, p, _CMP_LT_OQ)));
+                }
+                else
+                {
+                    const __m256 x = _mm256_loadu_ps(first + j), p = _mm256_set1_ps(pivot);
+                    m = static_cast<unsigned>(_mm256_movemask_ps(greater ? _mm256_cmp_ps(p, x, _CMP_LT_OQ)
+                                                                         : _mm256_cmp_ps(x, p, _CMP_LT_OQ)));
+                }
+            }
+            else
+            {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + j));
+                __m256i p;
+                if constexpr (sizeof(Tp) == 8)
+                    p = _mm256_set1_epi64x(static_cast<long long>(pivot));
+                else
+                    p = _mm256_set1_epi32(static_cast<int>(pivot));
+                if constexpr (std::is_unsigned<Tp>::value) // AVX2 only compares signed lanes
+                {
+                    const __m256i sign = sizeof(Tp) == 8 ? _mm256_set1_epi64x(INT64_MIN) : _mm256_set1_epi32(INT32_MIN);
+                    x = _mm256_xor_si256(x, sign);
+                    p = _mm256_xor_si256(p, sign);
+                }
+                if constexpr (sizeof(Tp) == 8)
+                    m = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(
+                        greater ? _mm256_cmpgt_epi64(x, p) : _mm256_cmpgt_epi64(p, x))));
+                else
+                    m = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(
+                        greater ? _mm256_cmpgt_epi32(x, p) : _mm256_cmpgt_epi32(p, x))));
+            }
+            bits |= m << j;
+        }
+        return bits;
+    }
+};
+
+template <class Tp, class Compare>
+struct simd_compare_block<cpu_isa::avx512, Tp, Compare>
+{
+    static constexpr bool enabled = is_simd_lane_type<Tp> &&
+                                    is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
+
+    SORTER_TARGET_AVX512 static inline uint64_t
+    mask(const Tp* first, Tp pivot) noexcept
+    {
+        constexpr bool greater = is_greater_comparator<typename std::remove_cvref<Compare>::type>;
+        constexpr int lanes = 64 / sizeof(Tp);
+        uint64_t bits = 0;
+        for (int j = 0; j < 64; j += lanes)
+        {
+            uint64_t m;
+            if constexpr (std::is_same<Tp, double>::value)
+            {
+                const __m512d x = _mm512_loadu_pd(first + j), p = _mm512_set1_pd(pivot);
+                m = greater ? _mm512_cmp_pd_mask(p, x, _CMP_LT_OQ) : _mm512_cmp_pd_mask(x, p, _CMP_LT_OQ);
+            }
+            else if constexpr (std::is_same<Tp, float>::value)
+            {
+                const __m512 x = _mm512_loadu_ps(first + j), p = _mm512_set1_ps(pivot);
+                m = greater ? _mm512_cmp_ps_mask(p, x, _CMP_LT_OQ) : _mm512_cmp_ps_mask(x, p, _CMP_LT_OQ);
+            }
+            else
+            {
+                const __m512i x = _mm512_loadu_si512(first + j);
+                if constexpr (sizeof(Tp) == 8 && std::is_signed<Tp>::value)
+                {
+                    const __m512i p = _mm512_set1_epi64(static_cast<long long>(pivot));
+                    m = greater ? _mm512_cmpgt_epi64_mask(x, p) : _mm512_cmplt_epi64_mask(x, p);
+                }
+                else if constexpr (sizeof(Tp) == 8)
+                {
+                    const __m512i p = _mm512_set1_epi64(static_cast<long long>(pivot));
+                    m = greater ? _mm512_cmpgt_epu64_mask(x, p) : _mm512_cmplt_epu64_mask(x, p);
+                }
+                else if constexpr (std::is_signed<Tp>::value)
+                {
+                    const __m512i p = _mm512_set1_epi32(static_cast<int>(pivot));
+                    m = greater ? _mm512_cmpgt_epi32_mask(x, p) : _mm512_cmplt_epi32_mask(x, p);
+                }
+                else
+                {
+                    const __m512i p = _mm512_set1_epi32(static_cast<int>(pivot));
+                    m = greater ? _mm512_cmpgt_epu32_mask(x, p) : _mm512_cmplt_epu32_mask(x, p);
+                }
+            }
+            bits |= m << j;
+        }
+        return bits;
+    }
+};
+#endif // SORTER_CPU_DISPATCH
+SORTER_END
+#endif // CPU_DISPATCH_H_INCLUDED
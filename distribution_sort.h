@@ -0,0 +1,278 @@
+#ifndef DISTRIBUTION_SORT_H_INCLUDED
+#define DISTRIBUTION_SORT_H_INCLUDED
+#include "qsort.h"
+#include <cmath>
+
+SORTER_BEGIN
+// Shorter ranges go straight to qsort.
+INLINE_VAR constexpr ptrdiff_t DISTRIBUTION_MIN_LEN = 1 << 14;
+// Expected elements per bucket, and the most buckets of one scatter pass (at most 1 << 16).
+INLINE_VAR constexpr ptrdiff_t DISTRIBUTION_BUCKET_LEN = 256;
+INLINE_VAR constexpr ptrdiff_t DISTRIBUTION_MAX_BUCKETS = 1 << 12;
+// Segments of the piecewise-linear model; a power of two.
+INLINE_VAR constexpr int DISTRIBUTION_SEGMENTS = 64;
+// Fall back to quick_sort once a bucket holds this many times the expected count.
+INLINE_VAR constexpr ptrdiff_t DISTRIBUTION_MAX_SKEW = 8;
+
+// Piecewise-linear model of the CDF of a sorted sample, mapping a key to its bucket:
+// [front, back] is cut into DISTRIBUTION_SEGMENTS of equal width, and each segment
+// spreads its share of the sample evenly over its buckets. Monotone in the comparator's
+// order, including for std::greater, where back < front.
+template <class Tp>
+class floating_cdf_model
+{
+public:
+    template <class Iter>
+    floating_cdf_model(Iter sample_first,
+                       Iter sample_last,
+                       ptrdiff_t buckets)
+        : low_(static_cast<double>(*sample_first)), last_bucket_(static_cast<double>(buckets - 1))
+    {
+        const ptrdiff_t samples = sample_last - sample_first;
+        const double width = (static_cast<double>(*(sample_last - 1)) - low_) / DISTRIBUTION_SEGMENTS;
+        scale_ = 1.0 / width;
+        // base_[s] = buckets * share of the sample before segment s
+        Iter it = sample_first;
+        for (int seg = 0; seg <= DISTRIBUTION_SEGMENTS; ++seg)
+        {
+            const double bound = low_ + width * seg;
+            while (it != sample_last && (width > 0 ? static_cast<double>(*it) < bound : static_cast<double>(*it) > bound))
+                ++it;
+            // whole numbers, so a segment never maps past the first bucket of the next one.
+            base_[seg] = static_cast<double>(buckets * (it - sample_first) / samples);
+        }
+        base_[DISTRIBUTION_SEGMENTS] = static_cast<double>(buckets);
+        // pos = base_[s] + (t - s) * slope_[s] = offset_[s] + t * slope_[s]
+        for (int seg = 0; seg < DISTRIBUTION_SEGMENTS; ++seg)
+        {
+            slope_[seg]  = base_[seg + 1] - base_[seg];
+            offset_[seg] = base_[seg] - seg * slope_[seg];
+        }
+    }
+
+    // false if the sample spans a single value, or the keys are not finite.
+    bool usable() const noexcept
+    { return std::isfinite(scale_); }
+
+    SORTER_FORCEINLINE size_t operator()(const Tp& val) const noexcept
+    {
+        double t = (static_cast<double>(val) - low_) * scale_;
+        t = t > 0 ? t : 0; // also maps NaN to the first bucket
+        t = t < DISTRIBUTION_SEGMENTS ? t : DISTRIBUTION_SEGMENTS;
+        const int seg = std::min(static_cast<int>(t), DISTRIBUTION_SEGMENTS - 1);
+        // clamped to the segment's buckets, as the rounding of offset_ may leave them.
+        const double pos = std::min(std::max(offset_[seg] + t * slope_[seg], base_[seg]), base_[seg + 1]);
+        return static_cast<size_t>(pos < last_bucket_ ? pos : last_bucket_);
+    }
+
+private:
+    double low_;
+    double scale_;
+    double last_bucket_;
+    double base_[DISTRIBUTION_SEGMENTS + 1];
+    double offset_[DISTRIBUTION_SEGMENTS];
+    double slope_[DISTRIBUTION_SEGMENTS];
+};
+
+// The same model for integral keys in integer arithmetic, which is several times
+// cheaper to evaluate than converting each key to double. Keys are mapped to unsigned
+// values in the comparator's order, and the segments are 2^shift_ wide.
+template <class Tp>
+class integral_cdf_model
+{
+public:
+    typedef typename std::make_unsigned<Tp>::type unsigned_type;
+
+    template <class Iter>
+    integral_cdf_model(Iter sample_first,
+                       Iter sample_last,
+                       ptrdiff_t buckets)
+        : descending_(*(sample_last - 1) < *sample_first)
+    {
+        const ptrdiff_t samples = sample_last - sample_first;
+        low_  = to_unsigned(*sample_first);
+        span_ = to_unsigned(*(sample_last - 1)) - low_;
+        shift_ = std::max(static_cast<int>(std::bit_width(span_)) - log2_segments, 0);
+        // the fraction within a segment keeps FRACTION_BITS bits, so that it can be
+        // multiplied by a bucket count without overflow.
+        frac_shift_ = std::max(shift_ - FRACTION_BITS, 0);
+        Iter it = sample_first;
+        for (int seg = 0; seg <= DISTRIBUTION_SEGMENTS; ++seg)
+        {
+            if (static_cast<uint64_t>(seg) > (static_cast<uint64_t>(span_) >> shift_))
+            {
+                base_[seg] = static_cast<uint32_t>(buckets);
+                continue;
+            }
+            const unsigned_type bound = static_cast<unsigned_type>(low_ + (static_cast<unsigned_type>(seg) << shift_));
+            while (it != sample_last && to_unsigned(*it) < bound)
+                ++it;
+            base_[seg] = static_cast<uint32_t>(buckets * (it - sample_first) / samples);
+        }
+    }
+
+    // false if the sample spans a single value.
+    bool usable() const noexcept
+    { return span_ != 0; }
+
+    SORTER_FORCEINLINE size_t operator()(const Tp& val) const noexcept
+    {
+        const unsigned_type key = to_unsigned(val);
+        unsigned_type dist = key > low_ ? static_cast<unsigned_type>(key - low_) : unsigned_type(0);
+        dist = dist < span_ ? dist : span_;
+        const size_t seg  = static_cast<size_t>(dist >> shift_);
+        const uint64_t frac = static_cast<uint64_t>(dist & ((unsigned_type(1) << shift_) - 1)) >> frac_shift_;
+        // below base_[seg + 1], as frac < 2^(shift_ - frac_shift_)
+        return base_[seg] + static_cast<size_t>((frac * (base_[seg + 1] - base_[seg])) >> (shift_ - frac_shift_));
+    }
+
+private:
+    static constexpr int log2_segments = std::bit_width(static_cast<unsigned>(DISTRIBUTION_SEGMENTS)) - 1;
+    static constexpr int FRACTION_BITS = 24;
+
+    // order preserving: flips the sign bit of signed keys, and all bits for std::greater.
+    SORTER_FORCEINLINE unsigned_type to_unsigned(const Tp& val) const noexcept
+    {
+        unsigned_type key = static_cast<unsigned_type>(val);
+        if constexpr (std::is_signed<Tp>::value)
+            key ^= unsigned_type(1) << (sizeof(Tp) * __CHAR_BIT__ - 1);
+        return descending_ ? static_cast<unsigned_type>(~key) : key;
+    }
+
+    bool descending_;
+    unsigned_type low_;
+    unsigned_type span_;
+    int shift_;
+    int frac_shift_;
+    uint32_t base_[DISTRIBUTION_SEGMENTS + 1];
+};
+
+template <class Tp>
+using cdf_model = typename std::conditional<std::is_integral<Tp>::value,
+                                            integral_cdf_model<Tp>,
+                                            floating_cdf_model<Tp>>::type;
+
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+void
+distribution_sort_arithmetic(const RandomAccessIterator first,
+                             const RandomAccessIterator last,
+                             Compare& comp,
+                             Observer& obs)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    const ptrdiff_t len = last - first;
+    scoped_scratch scratch;
+    const ptrdiff_t buckets = std::min(len / DISTRIBUTION_BUCKET_LEN, DISTRIBUTION_MAX_BUCKETS);
+    scratch.reserve(static_cast<size_t>(len) * (sizeof(value_type) + sizeof(uint16_t)) +
+                    static_cast<size_t>(buckets + 1) * sizeof(size_t) + 2 * scratch_arena::ALIGNMENT);
+    // room for the whole range: the buffer holds the sample first, then the scatter.
+    value_type* sample  = scratch.allocate<value_type>(static_cast<size_t>(len));
+    size_t*     offsets = scratch.allocate<size_t>(static_cast<size_t>(buckets) + 1);
+    uint16_t*   ids     = scratch.allocate<uint16_t>(static_cast<size_t>(len)); // bucket of each element
+    if (sample == nullptr || offsets == nullptr || ids == nullptr)
+    {
+        qsort(first, last, comp, obs);
+        return;
+    }
+
+    auto start = observe_start(obs);
+    value_type* sample_last = sample;
+    auto gather = [&sample_last](RandomAccessIterator it) { *sample_last++ = *it; };
+    for_each_pivot_sample(first, len >> 3, gather);
+    qsort(sample, sample_last, comp);
+    const cdf_model<value_type> model(sample, sample_last, buckets);
+    if (!model.usable())
+    {
+        quick_sort(first, last, comp, obs, log2i(len) << 1);
+        return;
+    }
+
+    std::fill(offsets, offsets + buckets + 1, size_t(0));
+    for (ptrdiff_t i = 0; i < len; ++i)
+    {
+        const size_t b = model(first[i]);
+        ids[i] = static_cast<uint16_t>(b);
+        ++offsets[b + 1];
+    }
+    const size_t max_count = static_cast<size_t>(DISTRIBUTION_MAX_SKEW * (len / buckets));
+    if (*std::max_element(offsets + 1, offsets + buckets + 1) > max_count)
+    {
+        quick_sort(first, last, comp, obs, log2i(len) << 1);
+        return;
+    }
+    for (ptrdiff_t b = 0; b < buckets; ++b)
+        offsets[b + 1] += offsets[b];
+
+    // scatter into the buffer (the sample is no longer needed), then copy back.
+    value_type* const buf = sample;
+    for (ptrdiff_t i = 0; i < len; ++i)
+        buf[offsets[ids[i]]++] = first[i];
+    std::copy_n(buf, len, first);
+    observe(obs, start, sort_event::partition, len, buckets, partition_kernel::distribution);
+
+    // offsets[b] is now the end of bucket b.
+    ptrdiff_t bucket_first = 0;
+    for (ptrdiff_t b = 0; b < buckets; ++b)
+    {
+        const ptrdiff_t bucket_last = static_cast<ptrdiff_t>(offsets[b]);
+        const ptrdiff_t bucket_len  = bucket_last - bucket_first;
+        if (bucket_len > tuning_of<value_type>::value.ssort_max)
+            quick_sort(first + bucket_first, first + bucket_last, comp, obs, log2i(bucket_len) << 1);
+        else if (bucket_len > 1)
+        {
+            start = observe_start(obs);
+            small_sort(first + bucket_first, first + bucket_last, comp);
+            observe(obs, start, sort_event::small_sort, bucket_len);
+        }
+        bucket_first = bucket_last;
+    }
+}
+
+// Sorts nearly uniformly distributed arithmetic keys with one scatter pass instead of
+// log2(N) partition levels. The sample choose_pivot would read is fitted with a
+// cdf_model, the elements are counted and scattered into up to DISTRIBUTION_MAX_BUCKETS
+// buckets of an out-of-place buffer, and each bucket is finished with small_sort or
+// quick_sort. Falls back to qsort for other types and comparators, short ranges, and
+// inputs where the counts show a bucket more than DISTRIBUTION_MAX_SKEW times its
+// expected size, so skewed inputs only pay for the sample and the counting pass.
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+void
+distribution_sort(const RandomAccessIterator first,
+                  const RandomAccessIterator last,
+                  Compare comp,
+                  Observer&& obs)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    if constexpr (use_branchless_sort<RandomAccessIterator, Compare> && !std::is_same<value_type, bool>::value)
+    {
+        if (last - first >= DISTRIBUTION_MIN_LEN)
+        {
+            distribution_sort_arithmetic(first, last, comp, obs);
+            return;
+        }
+    }
+    qsort(first, last, comp, obs);
+}
+
+template <class RandomAccessIterator,
+          class Compare>
+inline void
+distribution_sort(const RandomAccessIterator first,
+                  const RandomAccessIterator last,
+                  Compare comp)
+{ distribution_sort(first, last, comp, null_observer{}); }
+
+template <class RandomAccessIterator>
+inline void
+distribution_sort(const RandomAccessIterator first,
+                  const RandomAccessIterator last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    distribution_sort(first, last, std::less<value_type>{});
+}
+SORTER_END
+#endif // DISTRIBUTION_SORT_H_INCLUDED
@@ -0,0 +1,338 @@
+#ifndef INCREMENTAL_SORT_H_INCLUDED
+#define INCREMENTAL_SORT_H_INCLUDED
+#include "qsort.h"
+#include <chrono>
+#include <vector>
+
+SORTER_BEGIN
+// Ranges up to this length are finished with a single quick_sort call.
+INLINE_VAR constexpr ptrdiff_t INCREMENTAL_LEAF_LEN = 1024;
+// Work units per step() call made by step_for() between two clock reads.
+INLINE_VAR constexpr ptrdiff_t INCREMENTAL_STEP_LEN = 16384;
+
+// A resumable qsort. The recursion of quick_sort is replaced by an explicit stack of
+// pending ranges, and the partitions of ranges above INCREMENTAL_LEAF_LEN are Lomuto
+// scans which can stop after any element, so each step() call does about 'budget'
+// element operations before it yields. The leaves are sorted with quick_sort; the
+// heap_sort fallback for a range which exhausts its depth limit is resumable too, at
+// log2(len) units per sift.
+//
+// Difference to qsort: a presorted prefix is not merged (the whole range is sorted once
+// it is not fully ascending or descending).
+//
+// The pivot samples are randomized as by pivot_seed if a seed is passed to the
+// constructor; its sequence carries on from one step to the next. Without one, a
+// pivot_seed_scope around a step applies to that step only.
+template <class RandomAccessIterator,
+          class Compare = std::less<typename std::iterator_traits<RandomAccessIterator>::value_type>>
+class incremental_sort
+{
+public:
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    typedef typename std::iterator_traits<RandomAccessIterator>::pointer pointer;
+
+    incremental_sort(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     Compare comp = Compare{})
+        : first_(first), last_(last), comp_(comp), cursor_(first), store_(first)
+    {
+        if (last - first < 2)
+        {
+            phase_ = phase::done;
+            return;
+        }
+        descending_ = comp_(*next_iter(first), *first);
+        cursor_ = first + 2;
+    }
+
+    incremental_sort(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     Compare comp,
+                     pivot_seed seed)
+        : incremental_sort(first, last, comp)
+    { pivot_state_ = pivot_state_of(seed); }
+
+    bool done() const noexcept
+    { return phase_ == phase::done; }
+
+    // Runs for about 'budget' element operations. Returns whether the range is sorted.
+    bool step(difference_type budget)
+    {
+        switch (phase_)
+        {
+        case phase::detect_run:
+            if (!detect_run(budget))
+                return false;
+            if (phase_ != phase::reverse)
+                break;
+            [[fallthrough]];
+        case phase::reverse:
+            return reverse(budget);
+        case phase::sort:
+            break;
+        case phase::done:
+            return true;
+        }
+        return sort(budget);
+    }
+
+    // Keeps stepping until the range is sorted or 'limit' has elapsed. The clock is read
+    // between steps, so the last step may overrun the limit by its own duration.
+    template <class Rep,
+              class Period>
+    bool step_for(std::chrono::duration<Rep, Period> limit)
+    {
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + limit;
+        while (!step(INCREMENTAL_STEP_LEN))
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+        return true;
+    }
+
+private:
+    enum class phase
+    {
+        detect_run,
+        reverse,
+        sort,
+        done
+    };
+
+    struct pending_range
+    {
+        RandomAccessIterator first;
+        RandomAccessIterator last;
+        difference_type depth_limit;
+        pointer ancestor_pivot;
+    };
+
+    // Same as find_existing_run, resumable. Returns false if the budget ran out.
+    bool detect_run(difference_type& budget)
+    {
+        for (; cursor_ != last_; ++cursor_, --budget)
+        {
+            if (budget <= 0)
+                return false;
+            const bool in_run = descending_ ? comp_(*cursor_, *prev_iter(cursor_))
+                                            : !comp_(*cursor_, *prev_iter(cursor_));
+            if (!in_run)
+            {
+                stack_.push_back(pending_range{first_, last_, log2i(last_ - first_) << 1, nullptr});
+                phase_ = phase::sort;
+                return true;
+            }
+        }
+        if (descending_) // strictly descending ==> reverse
+        {
+            cursor_ = first_;
+            store_  = last_;
+            phase_  = phase::reverse;
+        }
+        else // ascending ==> no operation
+            phase_ = phase::done;
+        return true;
+    }
+
+    bool reverse(difference_type& budget)
+    {
+        for (; cursor_ < store_ && cursor_ < --store_; ++cursor_, --budget)
+        {
+            if (budget <= 0)
+            {
+                ++store_;
+                return false;
+            }
+            std::iter_swap(cursor_, store_);
+        }
+        phase_ = phase::done;
+        return true;
+    }
+
+    // Makes pivot_state_, if seeded, the active_pivot_state during a step, and keeps
+    // where its sequence got to.
+    class pivot_state_swap
+    {
+    public:
+        explicit pivot_state_swap(uint64_t& state) noexcept
+            : state_(state), previous_(active_pivot_state)
+        {
+            if (state_ != 0)
+                active_pivot_state = state_;
+        }
+
+        ~pivot_state_swap()
+        {
+            if (state_ != 0)
+                state_ = active_pivot_state;
+            active_pivot_state = previous_;
+        }
+
+        pivot_state_swap(const pivot_state_swap&) = delete;
+        pivot_state_swap& operator=(const pivot_state_swap&) = delete;
+
+    private:
+        uint64_t& state_;
+        uint64_t previous_;
+    };
+
+    bool sort(difference_type budget)
+    {
+        pivot_state_swap seeded(pivot_state_);
+        while (budget > 0)
+        {
+            if (partitioning_)
+            {
+                if (!partition(budget))
+                    return false;
+                continue;
+            }
+            if (heap_idx_ > 0)
+            {
+                if (!heap_sort_step(budget))
+                    return false;
+                continue;
+            }
+            if (stack_.empty())
+            {
+                phase_ = phase::done;
+                return true;
+            }
+            pending_range range = stack_.back();
+            stack_.pop_back();
+            const difference_type len = range.last - range.first;
+            if (len <= INCREMENTAL_LEAF_LEN)
+            {
+                quick_sort(range.first, range.last, comp_, observer_, range.depth_limit, range.ancestor_pivot);
+                budget -= len * (log2i(len | 1) + 1);
+                continue;
+            }
+            if (range.depth_limit == 0)
+            {
+                active_   = range;
+                heap_idx_ = len + (len >> 1);
+                continue;
+            }
+            if (active_pivot_state != 0) // see pivot_seed
+                shuffle_pivot_sample(range.first, range.last, active_pivot_state);
+            choose_pivot(range.first, range.last, comp_);
+            // like quick_sort, gather the elements equal to an ancestor pivot on the left.
+            equal_mode_ = range.ancestor_pivot && !comp_(*range.ancestor_pivot, *range.first);
+            range.depth_limit -= 1;
+            active_  = range;
+            cursor_  = next_iter(range.first);
+            store_   = cursor_;
+            partitioning_ = true;
+        }
+        return false;
+    }
+
+    // Resumable Lomuto partition of active_ around *active_.first. Elements for which
+    // the predicate holds are gathered in [first + 1, store_).
+    bool partition(difference_type& budget)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        const RandomAccessIterator last = active_.last;
+        const difference_type n = std::min<difference_type>(budget, last - cursor_);
+        const RandomAccessIterator stop = cursor_ + n;
+        if (equal_mode_)
+            lomuto_scan(stop, reverse_predicate<Compare>{comp_});
+        else
+            lomuto_scan(stop, comp_);
+        budget -= n;
+        if (cursor_ != last)
+            return false;
+
+        partitioning_ = false;
+        RandomAccessIterator mid = prev_iter(store_);
+        if (mid != active_.first)
+        {
+            value_type pivot(std::move(*active_.first));
+            *active_.first = std::move(*mid);
+            *mid = std::move(pivot);
+        }
+        if (equal_mode_) // [first, mid] are all equal to the pivot
+        {
+            stack_.push_back(pending_range{next_iter(mid), last, active_.depth_limit, nullptr});
+            return true;
+        }
+        if (is_unbalanced(last - active_.first, mid - active_.first))
+        {
+            break_patterns(active_.first, mid);
+            break_patterns(next_iter(mid), last);
+        }
+        // the left range is popped first, as quick_sort recurses into it first.
+        stack_.push_back(pending_range{next_iter(mid), last, active_.depth_limit, std::to_address(mid)});
+        stack_.push_back(pending_range{active_.first, mid, active_.depth_limit, active_.ancestor_pivot});
+        return true;
+    }
+
+    // Same as heap_sort on active_, resumable. heap_idx_ counts down from len + len / 2:
+    // while it is at least len, node heap_idx_ - len is sifted to build the heap; below
+    // len, the maximum is popped to heap_idx_. Each sift costs log2(len) + 1 units.
+    bool heap_sort_step(difference_type& budget)
+    {
+        const RandomAccessIterator first = active_.first;
+        const difference_type len  = active_.last - first;
+        const difference_type cost = log2i(len) + 1;
+        for (; heap_idx_ > 0; --heap_idx_, budget -= cost)
+        {
+            if (budget <= 0)
+                return false;
+            difference_type node = 0;
+            if (heap_idx_ >= len)
+                node = heap_idx_ - len;
+            else
+                std::iter_swap(first, first + heap_idx_);
+            sift_down(first, first + std::min(heap_idx_, len), comp_, node);
+        }
+        return true;
+    }
+
+    template <class Predicate>
+    void lomuto_scan(const RandomAccessIterator stop, Predicate&& pred)
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        if constexpr (use_branchless_sort<RandomAccessIterator, Compare>)
+        {
+            // branchless: always swap, only advance the store on a match.
+            const value_type pivot = *active_.first;
+            for (; cursor_ != stop; ++cursor_)
+            {
+                const value_type val = *cursor_;
+                const bool matched = pred(val, pivot);
+                *cursor_ = *store_;
+                *store_  = val;
+                store_ += static_cast<difference_type>(matched);
+            }
+        }
+        else
+        {
+            for (; cursor_ != stop; ++cursor_)
+            {
+                if (pred(*cursor_, *active_.first))
+                {
+                    if (cursor_ != store_)
+                        std::iter_swap(cursor_, store_);
+                    ++store_;
+                }
+            }
+        }
+    }
+
+    RandomAccessIterator first_;
+    RandomAccessIterator last_;
+    Compare comp_;
+    uint64_t pivot_state_ = 0; // see pivot_seed
+    null_observer observer_;
+    phase phase_ = phase::detect_run;
+    bool descending_ = false;
+    bool partitioning_ = false;
+    bool equal_mode_ = false;
+    RandomAccessIterator cursor_;
+    RandomAccessIterator store_;
+    difference_type heap_idx_ = 0; // > 0 while active_ is heap sorted
+    pending_range active_{};
+    std::vector<pending_range> stack_;
+};
+SORTER_END
+#endif // INCREMENTAL_SORT_H_INCLUDED
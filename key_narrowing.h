@@ -0,0 +1,176 @@
+#ifndef KEY_NARROWING_H_INCLUDED
+#define KEY_NARROWING_H_INCLUDED
+#include "sort_aux.h"
+#include "cpu_dispatch.h"
+#include "scratch_arena.h"
+#include "sort_observer.h"
+#include <limits>
+
+SORTER_BEGIN
+// 64-bit integral keys often span much less than their width (timestamps of one day,
+// offsets in one file). qsort finds their minimum and maximum in one pass, and if the
+// span is at most key_narrowing_max_slots times the length, sorts them by counting
+// their offsets from the minimum, as counting_sort does for the 16-bit keys. Equal keys
+// are indistinguishable with the simple comparators, so the output is just the
+// histogram written back in order.
+template <class Iter,
+          class Compare,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool use_key_narrowing = std::is_integral<Tp>::value && sizeof(Tp) == 8 &&
+                                   is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
+
+// Below this length the extra pass costs more than counting saves.
+INLINE_VAR constexpr ptrdiff_t key_narrowing_min_len = 1 << 12;
+// Histogram slots per element beyond which clearing and scanning the histogram costs
+// more than sorting; the break-even is near 4.
+INLINE_VAR constexpr ptrdiff_t key_narrowing_max_slots = 2;
+// Larger histograms no longer stay in cache, and are filled as one.
+INLINE_VAR constexpr size_t key_narrowing_sub_histogram_max = size_t(1) << 16;
+
+template <class Tp>
+struct key_span
+{
+    Tp min;
+    Tp max;
+};
+
+// Minimum and maximum of [first, last), in four independent lanes which the compiler
+// turns into vector min/max where the target has them for 64-bit lanes.
+template <class Tp>
+SORTER_FORCEINLINE key_span<Tp>
+find_key_span_kernel(const Tp* first,
+                     const Tp* last) noexcept
+{
+    Tp lo[4] = {*first, *first, *first, *first};
+    Tp hi[4] = {*first, *first, *first, *first};
+    for (; last - first >= 4; first += 4)
+        for (int k = 0; k < 4; ++k)
+        {
+            lo[k] = first[k] < lo[k] ? first[k] : lo[k];
+            hi[k] = first[k] > hi[k] ? first[k] : hi[k];
+        }
+    for (; first != last; ++first)
+    {
+        lo[0] = *first < lo[0] ? *first : lo[0];
+        hi[0] = *first > hi[0] ? *first : hi[0];
+    }
+    return key_span<Tp>{std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3])),
+                        std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]))};
+}
+
+template <class Tp>
+struct find_key_span_kernels
+{
+    typedef key_span<Tp> (*function)(const Tp*, const Tp*);
+
+    static key_span<Tp> scalar(const Tp* first, const Tp* last)
+    { return find_key_span_kernel(first, last); }
+#if SORTER_CPU_DISPATCH
+    SORTER_TARGET_AVX2
+    static key_span<Tp> avx2(const Tp* first, const Tp* last)
+    { return find_key_span_kernel(first, last); }
+
+    SORTER_TARGET_AVX512
+    static key_span<Tp> avx512(const Tp* first, const Tp* last)
+    { return find_key_span_kernel(first, last); }
+#endif
+};
+
+template <class RandomAccessIterator>
+key_span<typename std::iterator_traits<RandomAccessIterator>::value_type>
+find_key_span(RandomAccessIterator first,
+              RandomAccessIterator last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    if constexpr (std::contiguous_iterator<RandomAccessIterator>)
+        return cpu_dispatched<find_key_span_kernels<value_type>>()(std::to_address(first), std::to_address(last));
+    else
+    {
+        key_span<value_type> span{*first, *first};
+        for (; first != last; ++first)
+        {
+            span.min = std::min(span.min, *first);
+            span.max = std::max(span.max, *first);
+        }
+        return span;
+    }
+}
+
+// Counts the offsets of [first, last) from 'min', all below 'slots', in 'subs' (1 or 2)
+// interleaved histograms (see counting_sub_histograms), and writes them back in order.
+template <class Compare,
+          class RandomAccessIterator,
+          class Tp>
+void
+counting_sort_offsets(RandomAccessIterator first,
+                      RandomAccessIterator last,
+                      Tp min,
+                      size_t slots,
+                      int subs,
+                      uint32_t* hist)
+{
+    typedef typename std::make_unsigned<Tp>::type unsigned_type;
+    const unsigned_type base = static_cast<unsigned_type>(min);
+    auto slot = [base](Tp val) { return static_cast<size_t>(static_cast<unsigned_type>(val) - base); };
+    std::fill_n(hist, slots * subs, 0u);
+    RandomAccessIterator it = first;
+    if (subs == 2)
+    {
+        for (; last - it >= 2; it += 2)
+        {
+            ++hist[slot(it[0])];
+            ++hist[slots + slot(it[1])];
+        }
+    }
+    for (; it != last; ++it)
+        ++hist[slot(*it)];
+    if (subs == 2)
+    {
+        for (size_t s = 0; s < slots; ++s)
+            hist[s] += hist[slots + s];
+    }
+
+    auto value = [base](size_t s) { return static_cast<Tp>(base + s); };
+    if constexpr (is_greater_comparator<typename std::remove_cvref<Compare>::type>)
+        for (size_t s = slots; s-- > 0;)
+            first = std::fill_n(first, hist[s], value(s));
+    else
+        for (size_t s = 0; s < slots; ++s)
+            first = std::fill_n(first, hist[s], value(s));
+}
+
+// Sorts [first, last) by counting the offsets of its keys from their minimum; see
+// use_key_narrowing. Returns false, with the range untouched, if the keys span too many
+// values for the length or the histogram cannot be allocated.
+template <class Compare,
+          class Observer,
+          class RandomAccessIterator>
+bool
+key_narrowing_sort(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Compare&,
+                   Observer& obs)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef typename std::make_unsigned<value_type>::type unsigned_type;
+    const ptrdiff_t len = last - first;
+    if (static_cast<uint64_t>(len) > std::numeric_limits<uint32_t>::max())
+        return false;
+    auto start = observe_start(obs);
+    const key_span<value_type> span = find_key_span(first, last);
+    const uint64_t width = static_cast<uint64_t>(static_cast<unsigned_type>(span.max) - static_cast<unsigned_type>(span.min));
+    if (width >= static_cast<uint64_t>(len) * key_narrowing_max_slots)
+        return false;
+
+    const size_t slots = static_cast<size_t>(width) + 1;
+    const int subs = slots <= key_narrowing_sub_histogram_max ? 2 : 1;
+    scoped_scratch scratch;
+    uint32_t* const hist = scratch.allocate<uint32_t>(slots * subs);
+    if (hist == nullptr)
+        return false;
+    counting_sort_offsets<Compare>(first, last, span.min, slots, subs, hist);
+    observe(obs, start, sort_event::partition, len, static_cast<ptrdiff_t>(slots), partition_kernel::counting);
+    return true;
+}
+SORTER_END
+#endif // KEY_NARROWING_H_INCLUDED
@@ -0,0 +1,184 @@
+#ifndef PARALLEL_MERGE_H_INCLUDED
+#define PARALLEL_MERGE_H_INCLUDED
+#include "sort_aux.h"
+#include "scratch_arena.h"
+#include <thread>
+#include <vector>
+
+SORTER_BEGIN
+// Each thread of parallel_merge gets at least this many output elements.
+INLINE_VAR constexpr ptrdiff_t PARALLEL_MERGE_MIN_SLICE = 1 << 16;
+
+// The number of threads qsort may use for the merge of its presorted-prefix branch, as
+// in qsort(first, last, comp, sort_threads{8}).
+struct sort_threads
+{
+    unsigned count;
+};
+
+// The thread count of the sort running on this thread; 1 unless set by merge_threads_scope.
+INLINE_VAR thread_local unsigned active_merge_threads = 1;
+
+// Sets active_merge_threads for the lifetime of the scope.
+class merge_threads_scope
+{
+public:
+    explicit merge_threads_scope(sort_threads threads) noexcept
+        : previous_(active_merge_threads)
+    { active_merge_threads = threads.count; }
+
+    ~merge_threads_scope()
+    { active_merge_threads = previous_; }
+
+    merge_threads_scope(const merge_threads_scope&) = delete;
+    merge_threads_scope& operator=(const merge_threads_scope&) = delete;
+
+private:
+    unsigned previous_;
+};
+
+// Calls func(k) for every k in [0, count): k = 0 on the calling thread, the others on
+// threads of their own. If a thread cannot be started, the calling thread runs its
+// share as well.
+template <class Function>
+void
+run_parallel(unsigned count,
+             Function& func)
+{
+    std::vector<std::thread> workers;
+    unsigned k = 1;
+    try
+    {
+        workers.reserve(count - 1);
+        for (; k < count; ++k)
+            workers.emplace_back([&func, k] { func(k); });
+    }
+    catch (...) // std::system_error or std::bad_alloc
+    {}
+    for (unsigned rest = k; rest < count; ++rest)
+        func(rest);
+    func(0);
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+// Merge path co-rank: the number of elements of the first run among the first 'diag'
+// elements of the stable merge of the sorted runs [first1, first1 + len1) and
+// [first2, first2 + len2). Found by binary search along the cross diagonal.
+template <class Compare,
+          class RandomAccessIterator1,
+          class RandomAccessIterator2,
+          class DistanceType>
+DistanceType
+merge_path_co_rank(RandomAccessIterator1 first1,
+                   DistanceType len1,
+                   RandomAccessIterator2 first2,
+                   DistanceType len2,
+                   DistanceType diag,
+                   Compare& comp)
+{
+    DistanceType lo = std::max(DistanceType(0), diag - len2);
+    DistanceType hi = std::min(diag, len1);
+    while (lo < hi)
+    {
+        const DistanceType i = lo + ((hi - lo) >> 1);
+        // first1[i] precedes first2[diag - i - 1] unless strictly greater, since ties
+        // are taken from the first run.
+        if (!comp(first2[diag - i - 1], first1[i]))
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+// Merges [first + i, first + i_end) and [mid + d0 - i, mid + d1 - i_end), the output
+// slice [d0, d1), into the uninitialized buffer 'buf' at the same offsets.
+template <class Compare,
+          class RandomAccessIterator,
+          class ValueType,
+          class DistanceType>
+void
+merge_path_slice(RandomAccessIterator first,
+                 RandomAccessIterator mid,
+                 Compare& comp,
+                 ValueType* buf,
+                 DistanceType d0,
+                 DistanceType d1,
+                 DistanceType i,
+                 const DistanceType i_end)
+{
+    DistanceType j = d0 - i;
+    const DistanceType j_end = d1 - i_end;
+    ValueType* out = buf + d0;
+    for (; i < i_end && j < j_end; ++out)
+    {
+        if (comp(mid[j], first[i]))
+        {
+            ::new (static_cast<void*>(out)) ValueType(std::move(mid[j]));
+            ++j;
+        }
+        else
+        {
+            ::new (static_cast<void*>(out)) ValueType(std::move(first[i]));
+            ++i;
+        }
+    }
+    out = std::uninitialized_move(first + i, first + i_end, out);
+    std::uninitialized_move(mid + j, mid + j_end, out);
+}
+
+// Merges the sorted runs [first, mid) and [mid, last) in place with up to 'threads'
+// threads. The output is cut into equal slices, the merge path co-rank search finds
+// where each slice starts in both runs, and every thread merges its slice into the
+// scratch buffer; then the slices are moved back, also in parallel. 'buf' is
+// uninitialized storage for last - first elements; without it the buffer comes from the
+// active scratch_arena or the heap, and if that fails the merge is std::inplace_merge.
+// The comparator is called concurrently, and neither it nor the moves of the value type
+// may throw.
+template <class RandomAccessIterator,
+          class Compare>
+void
+parallel_merge(RandomAccessIterator first,
+               RandomAccessIterator mid,
+               RandomAccessIterator last,
+               Compare comp,
+               unsigned threads,
+               typename std::iterator_traits<RandomAccessIterator>::value_type* buf = nullptr)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    const difference_type len = last - first;
+    if (first == mid || mid == last || !comp(*mid, *prev_iter(mid)))
+        return; // already in order
+    const difference_type max_slices = std::max(difference_type(1), len / PARALLEL_MERGE_MIN_SLICE);
+    const unsigned slices = static_cast<unsigned>(std::min(static_cast<difference_type>(std::max(threads, 1u)), max_slices));
+
+    scoped_scratch scratch;
+    if (buf == nullptr)
+        buf = scratch.allocate<value_type>(static_cast<size_t>(len));
+    if (buf == nullptr)
+    {
+        std::inplace_merge(first, mid, last, comp);
+        return;
+    }
+
+    auto bound = [len, slices](unsigned k) {
+        return static_cast<difference_type>(static_cast<uint64_t>(len) * k / slices);
+    };
+    // All co-ranks are found before any element is moved from.
+    std::vector<difference_type> co_ranks(slices + 1);
+    for (unsigned k = 0; k <= slices; ++k)
+        co_ranks[k] = merge_path_co_rank(first, mid - first, mid, last - mid, bound(k), comp);
+    auto merge_slice = [&](unsigned k) {
+        merge_path_slice(first, mid, comp, buf, bound(k), bound(k + 1), co_ranks[k], co_ranks[k + 1]);
+    };
+    auto move_back = [&](unsigned k) {
+        std::move(buf + bound(k), buf + bound(k + 1), first + bound(k));
+        std::destroy(buf + bound(k), buf + bound(k + 1));
+    };
+    run_parallel(slices, merge_slice);
+    run_parallel(slices, move_back);
+}
+SORTER_END
+#endif // PARALLEL_MERGE_H_INCLUDED
@@ -0,0 +1,195 @@
+#ifndef PERF_PROFILE_H_INCLUDED
+#define PERF_PROFILE_H_INCLUDED
+// Hardware performance counters per sort phase, for tuning the block_size, ssort_max and
+// pseudo_median_rec_threshold fields of sort_tuning. Only compiled in with -DSORTER_PERF_PROFILE (Linux only);
+// otherwise SORTER_PERF_PHASE expands to nothing.
+#ifdef SORTER_PERF_PROFILE
+#include "sort_aux.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+SORTER_BEGIN
+enum class perf_phase : int
+{
+    find_existing_run,
+    choose_pivot,
+    bitset_partition,
+    fulcrum_partition,
+    three_way_partition,
+    dual_pivot_partition,
+    small_sort,
+    inplace_merge,
+    count
+};
+
+enum perf_counter : int
+{
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+struct perf_totals
+{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> values[PERF_COUNTER_COUNT] = {};
+};
+
+INLINE_VAR perf_totals perf_phase_totals[static_cast<int>(perf_phase::count)];
+
+// One counter group per thread, opened on first use. The group is read with a single
+// read(2), so the counters of a phase are always sampled together.
+class perf_counter_group
+{
+public:
+    perf_counter_group() noexcept
+    {
+        static const uint64_t configs[PERF_COUNTER_COUNT] = {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_MISSES
+        };
+        for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type           = PERF_TYPE_HARDWARE;
+            attr.size           = sizeof(attr);
+            attr.config         = configs[i];
+            attr.read_format    = PERF_FORMAT_GROUP;
+            attr.disabled       = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            fds_[i] = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+            if (fds_[i] < 0)
+            {
+                close_all();
+                return;
+            }
+        }
+        ::ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~perf_counter_group()
+    { close_all(); }
+
+    bool available() const noexcept
+    { return fds_[0] >= 0; }
+
+    bool read(uint64_t (&out)[PERF_COUNTER_COUNT]) const noexcept
+    {
+        uint64_t buf[1 + PERF_COUNTER_COUNT]; // nr, then one value per counter
+        if (::read(fds_[0], buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf)))
+            return false;
+        for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+            out[i] = buf[1 + i];
+        return true;
+    }
+
+    static perf_counter_group& this_thread() noexcept
+    {
+        static thread_local perf_counter_group group;
+        return group;
+    }
+
+private:
+    void close_all() noexcept
+    {
+        for (int& fd : fds_)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+    }
+
+    int fds_[PERF_COUNTER_COUNT] = {-1, -1, -1};
+};
+
+// Accumulates the counter deltas of its lifetime into the totals of one phase.
+class perf_scope
+{
+public:
+    // constexpr so that profiled sorts stay usable in constant expressions; nothing is
+    // counted there.
+    constexpr explicit perf_scope(perf_phase phase) noexcept
+        : phase_(phase), start_{}, ok_(false)
+    {
+        if (!std::is_constant_evaluated())
+            ok_ = perf_counter_group::this_thread().read(start_);
+    }
+
+    constexpr ~perf_scope()
+    {
+        if (std::is_constant_evaluated())
+            return;
+        uint64_t stop[PERF_COUNTER_COUNT];
+        if (!ok_ || !perf_counter_group::this_thread().read(stop))
+            return;
+        perf_totals& totals = perf_phase_totals[static_cast<int>(phase_)];
+        totals.calls.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+            totals.values[i].fetch_add(stop[i] - start_[i], std::memory_order_relaxed);
+    }
+
+    perf_scope(const perf_scope&) = delete;
+    perf_scope& operator=(const perf_scope&) = delete;
+
+private:
+    perf_phase phase_;
+    uint64_t start_[PERF_COUNTER_COUNT];
+    bool ok_;
+};
+
+inline void perf_reset() noexcept
+{
+    for (perf_totals& totals : perf_phase_totals)
+    {
+        totals.calls.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& value : totals.values)
+            value.store(0, std::memory_order_relaxed);
+    }
+}
+
+inline void perf_report(std::FILE* out = stderr)
+{
+    static const char* const names[] = {
+        "find_existing_run", "choose_pivot", "bitset_partition",
+        "fulcrum_partition", "three_way_partition", "dual_pivot_partition", "small_sort",
+        "inplace_merge"
+    };
+    if (!perf_counter_group::this_thread().available())
+    {
+        std::fprintf(out, "sorter: perf_event_open unavailable (check kernel.perf_event_paranoid)\n");
+        return;
+    }
+    std::fprintf(out, "%-20s %12s %16s %14s %14s %10s\n",
+                 "phase", "calls", "instructions", "branch-misses", "cache-misses", "ins/call");
+    for (int p = 0; p < static_cast<int>(perf_phase::count); ++p)
+    {
+        const perf_totals& totals = perf_phase_totals[p];
+        const uint64_t calls = totals.calls.load(std::memory_order_relaxed);
+        const uint64_t ins   = totals.values[PERF_INSTRUCTIONS].load(std::memory_order_relaxed);
+        std::fprintf(out, "%-20s %12llu %16llu %14llu %14llu %10.1f\n", names[p],
+                     static_cast<unsigned long long>(calls),
+                     static_cast<unsigned long long>(ins),
+                     static_cast<unsigned long long>(totals.values[PERF_BRANCH_MISSES].load(std::memory_order_relaxed)),
+                     static_cast<unsigned long long>(totals.values[PERF_CACHE_MISSES].load(std::memory_order_relaxed)),
+                     calls ? double(ins) / double(calls) : 0.0);
+    }
+}
+SORTER_END
+
+#define SORTER_PERF_PHASE(phase) ::sorter::perf_scope sorter_perf_scope_(::sorter::perf_phase::phase)
+#else
+#define SORTER_PERF_PHASE(phase)
+#endif // SORTER_PERF_PROFILE
+#endif // PERF_PROFILE_H_INCLUDED
@@ -1,5 +1,11 @@
 #pragma once
 #include "small_sort.h"
+#include "sort_observer.h"
+#include "segmented_iterator.h"
+#include "parallel_merge.h"
+#include "counting_sort.h"
+#include "key_narrowing.h"
+#include "wide_key.h"
 
 SORTER_BEGIN
 template <class Compare,
@@ -13,7 +19,7 @@ sift_down(RandomAccessIterator first,
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
     const DistanceType len = last - first;
-    __builtin_assume(node < len);
+    SORTER_ASSUME(node < len);
     value_type tmp(std::move(*(first + node)));
     for (;;)
     {
@@ -39,7 +45,7 @@ heap_sort(RandomAccessIterator first,
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
     const difference_type len = last - first;
-    __builtin_assume(len >= 2);
+    SORTER_ASSUME(len >= 2);
     for (difference_type idx = len + (len >> 1); idx > 0; --idx)
     {
         difference_type sift_idx = idx >= len ? idx - len : (std::iter_swap(first, first + idx), 0);
@@ -49,7 +55,7 @@ heap_sort(RandomAccessIterator first,
 
 template <class Compare,
           class RandomAccessIterator>
-CONSTEXPR_CPP20 __forceinline RandomAccessIterator
+CONSTEXPR_CPP20 SORTER_FORCEINLINE RandomAccessIterator
 median_of_three(RandomAccessIterator a,
                 RandomAccessIterator b,
                 RandomAccessIterator c,
@@ -78,7 +84,8 @@ median_of_three_recursive(RandomAccessIterator a,
                           Compare& comp,
                           DistanceType step)
 {
-    if ((step << 3) >= PSEUDO_MEDIAN_REC_THRESHOLD)
+    constexpr int rec_threshold = tuning_of<typename std::iterator_traits<RandomAccessIterator>::value_type>::value.pseudo_median_rec_threshold;
+    if ((step << 3) >= rec_threshold)
     {
         const DistanceType next_step   = step >> 3;
         const DistanceType four_steps  = next_step << 2;
@@ -90,20 +97,150 @@ median_of_three_recursive(RandomAccessIterator a,
     return median_of_three(a, b, c, comp);
 }
 
+// Calls func(it) for each element which choose_pivot reads through
+// median_of_three_recursive, i.e. about sqrt(N) elements of [first, first + 8 * step),
+// in ascending position order. Pass step = len >> 3.
+template <class RandomAccessIterator,
+          class Function,
+          class DistanceType = typename std::iterator_traits<RandomAccessIterator>::difference_type>
+CONSTEXPR_CPP20 void
+for_each_pivot_sample(RandomAccessIterator first,
+                      DistanceType step,
+                      Function& func)
+{
+    constexpr int rec_threshold = tuning_of<typename std::iterator_traits<RandomAccessIterator>::value_type>::value.pseudo_median_rec_threshold;
+    const RandomAccessIterator candidates[3] = {first, first + (step << 2), first + step * 7};
+    for (RandomAccessIterator it : candidates)
+    {
+        if ((step << 3) >= rec_threshold)
+            for_each_pivot_sample(it, step >> 3, func);
+        else
+            func(it);
+    }
+}
+
 template <class Compare,
           class RandomAccessIterator>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE bool
+is_equivalent(RandomAccessIterator a,
+              RandomAccessIterator b,
+              Compare& comp)
+{ return !comp(*a, *b) && !comp(*b, *a); }
+
+// Seeds the pivot sample randomization of qsort, as in qsort(first, last, comp,
+// pivot_seed{seed}): the same seed and input always give the same sequence of
+// partitions, but an input can no longer be crafted against the sample positions.
+struct pivot_seed
+{
+    uint64_t value;
+};
+
+// The xorshift64 state of the pivot sample randomization of the sort running on this
+// thread; 0, the default, turns it off.
+INLINE_VAR thread_local uint64_t active_pivot_state = 0;
+
+// The first xorshift64 state of 'seed': the splitmix64 finalizer, so that nearby seeds
+// give unrelated sequences.
+constexpr uint64_t
+pivot_state_of(pivot_seed seed) noexcept
+{
+    uint64_t z = seed.value + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (z ^ (z >> 31)) | 1;
+}
+
+// Seeds active_pivot_state for the lifetime of the scope.
+class pivot_seed_scope
+{
+public:
+    explicit pivot_seed_scope(pivot_seed seed) noexcept
+        : previous_(active_pivot_state)
+    { active_pivot_state = pivot_state_of(seed); }
+
+    ~pivot_seed_scope()
+    { active_pivot_state = previous_; }
+
+    pivot_seed_scope(const pivot_seed_scope&) = delete;
+    pivot_seed_scope& operator=(const pivot_seed_scope&) = delete;
+
+private:
+    uint64_t previous_;
+};
+
+// Swaps every element choose_pivot samples from [first, last) with one at a position
+// drawn from the xorshift64 'state', so that the next pivot is not read from positions
+// the input could be arranged against. About sqrt(N) swaps.
+template <class RandomAccessIterator>
+CONSTEXPR_CPP20 void
+shuffle_pivot_sample(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     uint64_t& state)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    const difference_type len = last - first;
+    auto swap_with_random = [first, len, &state](RandomAccessIterator it) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        std::iter_swap(it, first + static_cast<difference_type>(state % static_cast<uint64_t>(len)));
+    };
+    for_each_pivot_sample(first, len >> 3, swap_with_random);
+}
+
+// Pattern breaking after an unbalanced partition, as in pdqsort: the pivot samples of
+// the parts are shuffled with a generator seeded by their length, so the same bad split
+// is not chosen over and over until depth_limit runs out.
+template <class RandomAccessIterator>
+CONSTEXPR_CPP20 void
+break_patterns(RandomAccessIterator first,
+               RandomAccessIterator last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    if (last - first <= tuning_of<value_type>::value.ssort_max)
+        return;
+    uint64_t state = static_cast<uint64_t>(last - first) * 0x9E3779B97F4A7C15ULL | 1;
+    shuffle_pivot_sample(first, last, state);
+}
+
+// Whether a part of 'part' elements out of 'len' leaves less than an eighth on one side.
+template <class DistanceType>
+CONSTEXPR_CPP20 SORTER_FORCEINLINE bool
+is_unbalanced(DistanceType len,
+              DistanceType part)
+{ return part < (len >> 3) || part > len - (len >> 3); }
+
+// Moves the pivot to 'first'. Returns whether the pivot is equivalent to one of the
+// other two candidates, which means the range very likely holds many duplicates.
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 inline bool
 choose_pivot(RandomAccessIterator first,
              RandomAccessIterator last,
              Compare& comp)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    SORTER_PERF_PHASE(choose_pivot);
     const difference_type len  = last - first;
     const difference_type step = len >> 3;
-    RandomAccessIterator mid = len < PSEUDO_MEDIAN_REC_THRESHOLD
-        ? median_of_three(first, first + (step << 2), first + step * 7, comp)
-        : median_of_three_recursive(first, first + (step << 2), first + step * 7, comp, step);
+    RandomAccessIterator a = first;
+    RandomAccessIterator b = first + (step << 2);
+    RandomAccessIterator c = first + step * 7;
+    if (len >= tuning_of<typename std::iterator_traits<RandomAccessIterator>::value_type>::value.pseudo_median_rec_threshold) // same as median_of_three_recursive, keeping a, b and c
+    {
+        const difference_type next_step   = step >> 3;
+        const difference_type four_steps  = next_step << 2;
+        const difference_type seven_steps = next_step * 7;
+        a = median_of_three_recursive(a, a + four_steps, a + seven_steps, comp, next_step);
+        b = median_of_three_recursive(b, b + four_steps, b + seven_steps, comp, next_step);
+        c = median_of_three_recursive(c, c + four_steps, c + seven_steps, comp, next_step);
+    }
+    RandomAccessIterator mid = median_of_three(a, b, c, comp);
+    const bool has_duplicates = mid == a ? is_equivalent(mid, b, comp) || is_equivalent(mid, c, comp)
+                              : mid == b ? is_equivalent(mid, a, comp) || is_equivalent(mid, c, comp)
+                              :            is_equivalent(mid, a, comp) || is_equivalent(mid, b, comp);
     std::iter_swap(first, mid);
+    return has_duplicates;
 }
 
 template <class Compare,
@@ -114,11 +251,17 @@ fulcrum_partition(RandomAccessIterator first,
                   Compare& comp)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    SORTER_PERF_PHASE(fulcrum_partition);
+    // with use_target_prefetch, both scans prefetch a block ahead of their comparisons
+    constexpr int ahead = tuning_of<value_type>::value.block_size;
     value_type pivot(std::move(*first));
     --last;
     for (;;)
     {
-        if (!comp(*last, pivot))
+        // 'first' holds the moved-from pivot, never compare against it.
+        if (last - first > ahead)
+            prefetch_element_target<Compare>(last - ahead);
+        if (first < last && !comp(*last, pivot))
         {
             --last;
             continue;
@@ -141,6 +284,8 @@ fulcrum_partition(RandomAccessIterator first,
                 return first;
             }
 
+            if (last - first > ahead)
+                prefetch_element_target<Compare>(first + ahead);
             if (comp(*first, pivot))
             {
                 ++first;
@@ -154,7 +299,7 @@ fulcrum_partition(RandomAccessIterator first,
 }
 
 template <class RandomAccessIterator>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 swap_bitmap_cyclic(RandomAccessIterator first,
                 RandomAccessIterator last,
                 uint64_t& left_bitset,
@@ -192,16 +337,56 @@ swap_bitmap_cyclic(RandomAccessIterator first,
     *r = std::move(tmp);
 }
 
+// !comp(first[j], pivot) for the 'count' elements from 'first', through compare_block.
+template <class Compare,
+          class RandomAccessIterator,
+          class ValueType>
+CONSTEXPR_CPP20 SORTER_FORCEINLINE uint64_t
+left_block_bitset(RandomAccessIterator first,
+                  int count,
+                  Compare& comp,
+                  ValueType& pivot)
+{
+    const uint64_t mask = count < 64 ? (static_cast<uint64_t>(1) << count) - 1 : ~static_cast<uint64_t>(0);
+    return ~static_cast<uint64_t>(comp.compare_block(first, count, pivot)) & mask;
+}
+
+// comp(last[-j], pivot) for the 'count' elements up to and including 'last', through
+// compare_block, which reads them in ascending order.
 template <class Compare,
+          class RandomAccessIterator,
+          class ValueType>
+CONSTEXPR_CPP20 SORTER_FORCEINLINE uint64_t
+right_block_bitset(RandomAccessIterator last,
+                   int count,
+                   Compare& comp,
+                   ValueType& pivot)
+{
+    const uint64_t bits = static_cast<uint64_t>(comp.compare_block(last - (count - 1), count, pivot));
+    return reverse_bits(bits) >> (64 - count);
+}
+
+template <cpu_isa Isa,
+          class Compare,
           class RandomAccessIterator,
           class ValueType = typename std::iterator_traits<RandomAccessIterator>::value_type>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 populate_left_bitset(RandomAccessIterator iter,
                      Compare& comp,
                      ValueType& pivot,
                      uint64_t& left_bitset)
 {
-    for (int j = 0; j < BLOCK_SIZE;)
+    if constexpr (has_compare_block<Compare, RandomAccessIterator>)
+    {
+        left_bitset = left_block_bitset(iter, tuning_of<ValueType>::value.block_size, comp, pivot);
+        return;
+    }
+    else if constexpr (use_simd_compare_block<Isa, RandomAccessIterator, Compare>)
+    {
+        left_bitset = ~simd_compare_block<Isa, ValueType, Compare>::mask(std::to_address(iter), pivot);
+        return;
+    }
+    for (int j = 0; j < tuning_of<ValueType>::value.block_size;)
     {
         bool comp_result = !comp(*iter, pivot);
         left_bitset |= (static_cast<uint64_t>(comp_result) << j);
@@ -210,16 +395,28 @@ populate_left_bitset(RandomAccessIterator iter,
     }
 }
 
-template <class Compare,
+template <cpu_isa Isa,
+          class Compare,
           class RandomAccessIterator,
           class ValueType = typename std::iterator_traits<RandomAccessIterator>::value_type>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 populate_right_bitset(RandomAccessIterator iter,
                       Compare& comp,
                       ValueType& pivot,
                       uint64_t& right_bitset)
 {
-    for (int j = 0; j < BLOCK_SIZE;)
+    if constexpr (has_compare_block<Compare, RandomAccessIterator>)
+    {
+        right_bitset = right_block_bitset(iter, tuning_of<ValueType>::value.block_size, comp, pivot);
+        return;
+    }
+    else if constexpr (use_simd_compare_block<Isa, RandomAccessIterator, Compare>)
+    {
+        // the block is [iter - 63, iter], and bit j stands for iter[-j].
+        right_bitset = reverse_bits(simd_compare_block<Isa, ValueType, Compare>::mask(std::to_address(iter) - 63, pivot));
+        return;
+    }
+    for (int j = 0; j < tuning_of<ValueType>::value.block_size;)
     {
         bool comp_result = comp(*iter, pivot);
         right_bitset |= (static_cast<uint64_t>(comp_result) << j);
@@ -231,7 +428,7 @@ populate_right_bitset(RandomAccessIterator iter,
 template <class Compare,
           class RandomAccessIterator,
           class ValueType = typename std::iterator_traits<RandomAccessIterator>::value_type>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 bitset_partition_partial_blocks(RandomAccessIterator& first,
                                 RandomAccessIterator& lm1,
                                 Compare& comp,
@@ -240,6 +437,7 @@ bitset_partition_partial_blocks(RandomAccessIterator& first,
                                 uint64_t& right_bitset)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    constexpr int block_size = tuning_of<ValueType>::value.block_size;
     difference_type remaining_len = lm1 - first + 1;
     difference_type l_size, r_size;
 
@@ -250,34 +448,44 @@ bitset_partition_partial_blocks(RandomAccessIterator& first,
     }
     else if (left_bitset == 0)
     {
-        l_size = remaining_len - BLOCK_SIZE;
-        r_size = BLOCK_SIZE;
+        l_size = remaining_len - block_size;
+        r_size = block_size;
     }
     else
     {
-        l_size = BLOCK_SIZE;
-        r_size = remaining_len - BLOCK_SIZE;
+        l_size = block_size;
+        r_size = remaining_len - block_size;
     }
 
-    if (left_bitset == 0)
+    if constexpr (has_compare_block<Compare, RandomAccessIterator>)
     {
-        RandomAccessIterator iter = first;
-        for (int j = 0; j < l_size; ++j)
+        if (left_bitset == 0 && l_size > 0)
+            left_bitset = left_block_bitset(first, static_cast<int>(l_size), comp, pivot);
+        if (right_bitset == 0 && r_size > 0)
+            right_bitset = right_block_bitset(lm1, static_cast<int>(r_size), comp, pivot);
+    }
+    else
+    {
+        if (left_bitset == 0)
         {
-            bool comp_result = !comp(*iter, pivot);
-            left_bitset |= (static_cast<uint64_t>(comp_result) << j);
-            ++iter;
+            RandomAccessIterator iter = first;
+            for (int j = 0; j < l_size; ++j)
+            {
+                bool comp_result = !comp(*iter, pivot);
+                left_bitset |= (static_cast<uint64_t>(comp_result) << j);
+                ++iter;
+            }
         }
-    }
 
-    if (right_bitset == 0)
-    {
-        RandomAccessIterator iter = lm1;
-        for (int j = 0; j < r_size; ++j)
+        if (right_bitset == 0)
         {
-            bool comp_result = comp(*iter, pivot);
-            right_bitset |= (static_cast<uint64_t>(comp_result) << j);
-            --iter;
+            RandomAccessIterator iter = lm1;
+            for (int j = 0; j < r_size; ++j)
+            {
+                bool comp_result = comp(*iter, pivot);
+                right_bitset |= (static_cast<uint64_t>(comp_result) << j);
+                --iter;
+            }
         }
     }
 
@@ -287,7 +495,7 @@ bitset_partition_partial_blocks(RandomAccessIterator& first,
 }
 
 template <class RandomAccessIterator>
-CONSTEXPR_CPP20 inline void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 swap_bitmap_pos_within(RandomAccessIterator& first,
                        RandomAccessIterator& lm1,
                        uint64_t& left_bitset,
@@ -298,7 +506,7 @@ swap_bitmap_pos_within(RandomAccessIterator& first,
     {
         while (left_bitset != 0)
         {
-            difference_type tz_left = BLOCK_SIZE - 1 - count_left_zero(left_bitset);
+            difference_type tz_left = 63 - count_left_zero(left_bitset); // highest set bit
             left_bitset &= (static_cast<uint64_t>(1) << tz_left) - 1;
             std::iter_swap(first + tz_left, lm1);
             --lm1;
@@ -309,7 +517,7 @@ swap_bitmap_pos_within(RandomAccessIterator& first,
     {
         while (right_bitset != 0)
         {
-            difference_type tz_right = BLOCK_SIZE - 1 - count_left_zero(right_bitset);
+            difference_type tz_right = 63 - count_left_zero(right_bitset);
             right_bitset &= (static_cast<uint64_t>(1) << tz_right) - 1;
             std::iter_swap(lm1 - tz_right, first);
             ++first;
@@ -317,15 +525,18 @@ swap_bitmap_pos_within(RandomAccessIterator& first,
     }
 }
 
-template <class Compare,
+template <cpu_isa Isa,
+          class Compare,
           class RandomAccessIterator>
-CONSTEXPR_CPP20 RandomAccessIterator
-bitset_partition(RandomAccessIterator first,
-                 RandomAccessIterator last,
-                 Compare& comp)
+CONSTEXPR_CPP20 SORTER_FORCEINLINE RandomAccessIterator
+bitset_partition_kernel(RandomAccessIterator first,
+                        RandomAccessIterator last,
+                        Compare& comp)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    SORTER_PERF_PHASE(bitset_partition);
+    constexpr int block_size = tuning_of<value_type>::value.block_size;
     RandomAccessIterator begin = first;
     value_type pivot(std::move(*first));
     while (++first < last && comp(*first, pivot));
@@ -340,18 +551,18 @@ bitset_partition(RandomAccessIterator first,
         // to be inclusive both side.
         uint64_t left_bitset  = 0;
         uint64_t right_bitset = 0;
-        while (lm1 - first >= 2 * BLOCK_SIZE - 1)
+        while (lm1 - first >= 2 * block_size - 1)
         {
             // Record the comparison outcomes for the elements currently on the left side.
             if (left_bitset == 0)
-                populate_left_bitset(first, comp, pivot, left_bitset);
+                populate_left_bitset<Isa>(first, comp, pivot, left_bitset);
             // Record the comparison outcomes for the elements currently on the right side.
             if (right_bitset == 0)
-                populate_right_bitset(lm1, comp, pivot, right_bitset);
+                populate_right_bitset<Isa>(lm1, comp, pivot, right_bitset);
              // Swap the elements recorded to be the candidates for swapping in the bitsets.
             swap_bitmap_cyclic(first, lm1, left_bitset, right_bitset);
-            first += (left_bitset == 0) ? difference_type(BLOCK_SIZE) : difference_type(0);
-            lm1 -= (right_bitset == 0) ? difference_type(BLOCK_SIZE) : difference_type(0);
+            first += (left_bitset == 0) ? difference_type(block_size) : difference_type(0);
+            lm1 -= (right_bitset == 0) ? difference_type(block_size) : difference_type(0);
         }
         // Now, we have a less-than a block worth of elements on at least one of the sides.
         bitset_partition_partial_blocks(first, lm1, comp, pivot, left_bitset, right_bitset);
@@ -365,6 +576,133 @@ bitset_partition(RandomAccessIterator first,
     return first;
 }
 
+// bitset_partition_kernel, with the bitset kernels inlined, built once per instruction set.
+template <class Compare,
+          class RandomAccessIterator>
+struct bitset_partition_kernels
+{
+    typedef RandomAccessIterator (*function)(RandomAccessIterator, RandomAccessIterator, Compare&);
+
+    static RandomAccessIterator scalar(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { return bitset_partition_kernel<cpu_isa::scalar>(first, last, comp); }
+#if SORTER_CPU_DISPATCH
+    SORTER_TARGET_AVX2
+    static RandomAccessIterator avx2(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { return bitset_partition_kernel<cpu_isa::avx2>(first, last, comp); }
+
+    SORTER_TARGET_AVX512
+    static RandomAccessIterator avx512(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { return bitset_partition_kernel<cpu_isa::avx512>(first, last, comp); }
+#endif
+};
+
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 RandomAccessIterator
+bitset_partition(RandomAccessIterator first,
+                 RandomAccessIterator last,
+                 Compare& comp)
+{
+    SORTER_IF_CONSTEVAL
+    {
+        return bitset_partition_kernel<cpu_isa::scalar>(first, last, comp);
+    }
+    return cpu_dispatched<bitset_partition_kernels<Compare, RandomAccessIterator>>()(first, last, comp);
+}
+
+// Dutch national flag partition around *first. On return [first, lt) < pivot,
+// [lt, gt) == pivot and [gt, last) > pivot.
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 std::pair<RandomAccessIterator, RandomAccessIterator>
+three_way_partition(RandomAccessIterator first,
+                    RandomAccessIterator last,
+                    Compare& comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    SORTER_PERF_PHASE(three_way_partition);
+    constexpr int ahead = tuning_of<value_type>::value.block_size;
+    value_type pivot(std::move(*first));
+    RandomAccessIterator lt = next_iter(first);
+    RandomAccessIterator gt = last;
+    for (RandomAccessIterator iter = lt; iter < gt;)
+    {
+        if (gt - iter > ahead)
+        {
+            prefetch_element_target<Compare>(iter + ahead);
+            prefetch_element_target<Compare>(gt - ahead);
+        }
+        if (comp(*iter, pivot))
+        {
+            if (iter != lt)
+                std::iter_swap(lt, iter);
+            ++lt;
+            ++iter;
+        }
+        else if (comp(pivot, *iter))
+            std::iter_swap(iter, --gt);
+        else
+            ++iter;
+    }
+    // [first + 1, lt) are the lesser elements, put the pivot right after them.
+    --lt;
+    if (lt != first)
+        *first = std::move(*lt);
+    *lt = std::move(pivot);
+    return std::pair<RandomAccessIterator, RandomAccessIterator>(lt, gt);
+}
+
+// Branchless three-way partition for integral types, where elements equal to the pivot
+// are indistinguishable from it. bitset_partition moves the lesser elements to the left;
+// the greater ones are then compacted to the right end with unconditional stores, and
+// the gap between them is refilled with the pivot.
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 std::pair<RandomAccessIterator, RandomAccessIterator>
+three_way_partition_branchless(RandomAccessIterator first,
+                               RandomAccessIterator last,
+                               Compare& comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    const value_type pivot = *first;
+    RandomAccessIterator lt = bitset_partition(first, last, comp);
+    SORTER_PERF_PHASE(three_way_partition);
+    RandomAccessIterator gt = last;
+    for (RandomAccessIterator iter = last; --iter != lt;)
+    {
+        const value_type val = *iter;
+        *--gt = val;
+        gt += static_cast<int>(!comp(pivot, val));
+    }
+    std::fill(lt, gt, pivot);
+    return std::pair<RandomAccessIterator, RandomAccessIterator>(lt, gt);
+}
+
+// Floating point keys keep the two-way bitset_partition: equal elements may differ
+// (-0.0 and 0.0), and the branchy kernel would be slower than the equal-element path.
+template <class Iter,
+          class Compare,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool use_three_way_partition = !use_branchless_sort<Iter, Compare> || std::is_integral<Tp>::value;
+
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 inline std::pair<RandomAccessIterator, RandomAccessIterator>
+three_way_partition_by_choosed_pivot(RandomAccessIterator first,
+                                     RandomAccessIterator last,
+                                     Compare& comp)
+{
+    if constexpr (use_branchless_sort<RandomAccessIterator, Compare>)
+        return three_way_partition_branchless(first, last, comp);
+    else
+        return three_way_partition(first, last, comp);
+}
+
+template <class RandomAccessIterator,
+          class Compare>
+constexpr partition_kernel chosen_partition_kernel =
+    use_bitset_partition<RandomAccessIterator, Compare> ? partition_kernel::bitset : partition_kernel::fulcrum;
+
 template <class Compare,
           class RandomAccessIterator>
 CONSTEXPR_CPP20
@@ -373,7 +711,7 @@ partition_by_choosed_pivot(RandomAccessIterator first,
                            RandomAccessIterator last,
                            Compare&& comp)
 {
-    if constexpr (use_branchless_sort<RandomAccessIterator, Compare>)
+    if constexpr (use_bitset_partition<RandomAccessIterator, Compare>)
         return bitset_partition(first, last, comp);
     else
         return fulcrum_partition(first, last, comp);
@@ -390,20 +728,133 @@ struct reverse_predicate
 };
 
 template <class Compare,
+          class Observer,
           class RandomAccessIterator>
 CONSTEXPR_CPP20 inline void
 quick_sort(RandomAccessIterator first,
            RandomAccessIterator last,
            Compare& comp,
+           Observer& obs,
            typename std::iterator_traits<RandomAccessIterator>::difference_type depth_limit,
-           typename std::iterator_traits<RandomAccessIterator>::pointer ancestor_pivot = nullptr)
+           typename std::iterator_traits<RandomAccessIterator>::pointer ancestor_pivot = nullptr);
+
+template <class Compare,
+          class Observer,
+          class SegmentedIterator>
+void
+segmented_quick_sort(SegmentedIterator first,
+                     SegmentedIterator last,
+                     Compare& comp,
+                     Observer& obs,
+                     typename std::iterator_traits<SegmentedIterator>::difference_type depth_limit,
+                     typename std::iterator_traits<SegmentedIterator>::pointer ancestor_pivot);
+
+// Moves the sample choose_pivot would read (about sqrt(N) elements) to the front of
+// [first, last) and sorts it. Returns the elements at a third and two thirds of the
+// sorted sample.
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 std::pair<RandomAccessIterator, RandomAccessIterator>
+choose_dual_pivots(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Compare& comp)
 {
+    RandomAccessIterator sample_last = first;
+    {
+        SORTER_PERF_PHASE(choose_pivot);
+        // the sample positions ascend from 'first', so each swap moves an unsampled element.
+        auto gather = [&sample_last](RandomAccessIterator it) { std::iter_swap(sample_last++, it); };
+        for_each_pivot_sample(first, (last - first) >> 3, gather);
+    }
+    // sorted outside of the choose_pivot phase, so its partitions and small sorts are not
+    // counted in both.
+    null_observer obs;
+    quick_sort(first, sample_last, comp, obs, log2i(sample_last - first) << 1);
+    const auto third = (sample_last - first) / 3;
+    return std::pair<RandomAccessIterator, RandomAccessIterator>(first + third, first + (third << 1));
+}
+
+// Partitions [first, last) into < *first, [*first, *(last - 1)] and > *(last - 1), where
+// the pivots satisfy !comp(*(last - 1), *first). Returns the final pivot positions.
+// Yaroslavskiy's scheme: the middle elements are skipped over, and greater elements are
+// swapped with the next element from the right that is not greater.
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 std::pair<RandomAccessIterator, RandomAccessIterator>
+dual_pivot_partition(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     Compare& comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    SORTER_PERF_PHASE(dual_pivot_partition);
+    constexpr int ahead = tuning_of<value_type>::value.block_size;
+    const RandomAccessIterator low  = first;
+    const RandomAccessIterator high = prev_iter(last);
+    RandomAccessIterator lt = next_iter(first);
+    RandomAccessIterator gt = prev_iter(high);
+    for (RandomAccessIterator it = lt; it <= gt; ++it)
+    {
+        if (gt - it > ahead)
+        {
+            prefetch_element_target<Compare>(it + ahead);
+            prefetch_element_target<Compare>(gt - ahead);
+        }
+        if (comp(*it, *low))
+        {
+            std::iter_swap(it, lt);
+            ++lt;
+        }
+        else if (comp(*high, *it))
+        {
+            while (it < gt && comp(*high, *gt))
+                --gt;
+            std::iter_swap(it, gt);
+            --gt;
+            if (comp(*it, *low))
+            {
+                std::iter_swap(it, lt);
+                ++lt;
+            }
+        }
+    }
+    --lt;
+    ++gt;
+    std::iter_swap(low, lt);
+    std::iter_swap(high, gt);
+    return std::pair<RandomAccessIterator, RandomAccessIterator>(lt, gt);
+}
+
+// The types with bitset_partition stay with it: its branchless blocks partition faster
+// than any dual-pivot scan, so streaming the range fewer times does not pay for them.
+template <class Iter,
+          class Compare>
+constexpr bool use_dual_pivot_partition = !use_bitset_partition<Iter, Compare>;
+
+template <class Compare,
+          class Observer,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 inline void
+quick_sort(RandomAccessIterator first,
+           RandomAccessIterator last,
+           Compare& comp,
+           Observer& obs,
+           typename std::iterator_traits<RandomAccessIterator>::difference_type depth_limit,
+           typename std::iterator_traits<RandomAccessIterator>::pointer ancestor_pivot)
+{
+    if constexpr (is_segmented_iterator<RandomAccessIterator>)
+    {
+        segmented_quick_sort(first, last, comp, obs, depth_limit, ancestor_pivot);
+        return;
+    }
+    constexpr sort_tuning tuning = tuning_of<typename std::iterator_traits<RandomAccessIterator>::value_type>::value;
     for (;;)
     {
+        const auto start = observe_start(obs);
         // smallsort is faster for small array.
-        if (last - first <= SSORT_MAX)
+        if (last - first <= tuning.ssort_max)
         {
-             small_sort(first, last, comp);
+            small_sort(first, last, comp);
+            observe(obs, start, sort_event::small_sort, last - first);
             return;
         }
 
@@ -412,32 +863,87 @@ quick_sort(RandomAccessIterator first,
         if (depth_limit == 0)
         {
             heap_sort(first, last, comp);
+            observe(obs, start, sort_event::heap_fallback, last - first);
             return;
         }
 
         --depth_limit; // allow 2log2(n) divisions.
 
-        // calculate the approximate median of 3 elements by median of 3 or
-        // recursively from an approximation of each, if they're large enough.
-        // this algorithm is taken from glidesort by Orson Peters.
-        choose_pivot(first, last, comp);
+        if (!std::is_constant_evaluated() && active_pivot_state != 0) // see pivot_seed
+            shuffle_pivot_sample(first, last, active_pivot_state);
+
+        // large ranges are split in three around the tertiles of the pivot sample, so
+        // they are streamed through memory log3(n) rather than log2(n) times.
+        bool has_duplicates;
+        if (use_dual_pivot_partition<RandomAccessIterator, Compare> && last - first >= tuning.dual_pivot_threshold)
+        {
+            const auto [low, high] = choose_dual_pivots(first, last, comp);
+            std::iter_swap(first, low);
+            // equal tertiles: the range very likely holds many duplicates.
+            has_duplicates = !comp(*first, *high);
+            if (!has_duplicates && !(ancestor_pivot && !comp(*ancestor_pivot, *first)))
+            {
+                std::iter_swap(prev_iter(last), high);
+                const auto [lt, gt] = dual_pivot_partition(first, last, comp);
+                observe(obs, start, sort_event::partition, last - first, lt - first, partition_kernel::dual_pivot);
+                if (is_unbalanced(last - first, lt - first) || is_unbalanced(last - first, last - gt))
+                {
+                    break_patterns(first, lt);
+                    break_patterns(next_iter(lt), gt);
+                    break_patterns(next_iter(gt), last);
+                }
+                quick_sort(first, lt, comp, obs, depth_limit, ancestor_pivot);
+                quick_sort(next_iter(lt), gt, comp, obs, depth_limit, std::to_address(lt));
+                ancestor_pivot = std::to_address(gt);
+                first = next_iter(gt);
+                continue;
+            }
+            // otherwise the smaller tertile is the pivot of the paths below.
+        }
+        else
+        {
+            // calculate the approximate median of 3 elements by median of 3 or
+            // recursively from an approximation of each, if they're large enough.
+            // this algorithm is taken from glidesort by Orson Peters.
+            has_duplicates = choose_pivot(first, last, comp);
+        }
 
         // if the chosen pivot is equal to the predecessor, we change the strategy,
         // putting the equal elements in the left partition, greater elements in
         // the right partition.
         if (ancestor_pivot && !comp(*ancestor_pivot, *first))
         {
-            first = partition_by_choosed_pivot(first, last, reverse_predicate{comp});
+            RandomAccessIterator mid = partition_by_choosed_pivot(first, last, reverse_predicate{comp});
+            observe(obs, start, sort_event::equal_elements, last - first, mid - first + 1);
             ancestor_pivot = nullptr;
-            ++first;
+            first = ++mid;
+            continue;
+        }
+
+        // if the pivot sample holds duplicates, group the elements equal to the pivot
+        // in the same pass so they are never touched again.
+        if (use_three_way_partition<RandomAccessIterator, Compare> && has_duplicates)
+        {
+            const auto [lt, gt] = three_way_partition_by_choosed_pivot(first, last, comp);
+            observe(obs, start, sort_event::partition, last - first, lt - first, partition_kernel::three_way);
+            quick_sort(first, lt, comp, obs, depth_limit, ancestor_pivot);
+            ancestor_pivot = nullptr; // [gt, last) is strictly greater than the pivot
+            first = gt;
             continue;
         }
 
         RandomAccessIterator mid = partition_by_choosed_pivot(first, last, comp);
-        __builtin_assume(mid < last);
+        SORTER_ASSUME(mid < last);
+        observe(obs, start, sort_event::partition, last - first, mid - first,
+                chosen_partition_kernel<RandomAccessIterator, Compare>);
+        if (is_unbalanced(last - first, mid - first))
+        {
+            break_patterns(first, mid);
+            break_patterns(next_iter(mid), last);
+        }
         // sort the left partition first using recursion and do tail recursion elimination for
         // the right-hand partition.
-        quick_sort(first, mid, comp, depth_limit, ancestor_pivot);
+        quick_sort(first, mid, comp, obs, depth_limit, ancestor_pivot);
         ancestor_pivot = std::to_address(mid);
         first = ++mid;
     }
@@ -450,6 +956,7 @@ find_existing_run(RandomAccessIterator first,
                   RandomAccessIterator last,
                   Compare& comp)
 {
+    SORTER_PERF_PHASE(find_existing_run);
     if (last - first < 2) // 0 or 1 element is sorted
         return std::pair<RandomAccessIterator, bool>(last, false);
     RandomAccessIterator mid = first;
@@ -464,31 +971,373 @@ find_existing_run(RandomAccessIterator first,
     return std::pair<RandomAccessIterator, bool>(mid, is_strictly_descending);
 }
 
-template <class Tp>
-inline constexpr Tp log2i(Tp val) noexcept
-{
-#if __cplusplus >= 201703L
-    return std::bit_width(std::make_unsigned_t<Tp>(val)) - 1;
-#else
-    const int sz = sizeof(+val);
-    int w = sz * __CHAR_BIT__ - 1;
-    if (sz == sizeof(long long))
-        w -= __builtin_clzll(+val);
-    else if (sz == sizeof(long))
-        w -= __builtin_clzl(+val);
-    else if (sz == sizeof(int))
-        w -= __builtin_clz(+val);
-    return w;
-#endif
+// Rotation based merge of [first, mid) and [mid, last) which never allocates. Used
+// where std::inplace_merge is unavailable, i.e. during constant evaluation.
+template <class Compare,
+          class BidirectionalIterator>
+CONSTEXPR_CPP20 void
+merge_without_buffer(BidirectionalIterator first,
+                     BidirectionalIterator mid,
+                     BidirectionalIterator last,
+                     Compare& comp)
+{
+    typedef typename std::iterator_traits<BidirectionalIterator>::difference_type difference_type;
+    difference_type len1 = std::distance(first, mid);
+    difference_type len2 = std::distance(mid, last);
+    while (len1 != 0 && len2 != 0)
+    {
+        if (len1 + len2 == 2)
+        {
+            if (comp(*mid, *first))
+                std::iter_swap(first, mid);
+            return;
+        }
+        BidirectionalIterator cut1 = first;
+        BidirectionalIterator cut2 = mid;
+        difference_type len11, len22;
+        if (len1 > len2)
+        {
+            len11 = len1 >> 1;
+            std::advance(cut1, len11);
+            cut2 = std::lower_bound(mid, last, *cut1, comp);
+            len22 = std::distance(mid, cut2);
+        }
+        else
+        {
+            len22 = len2 >> 1;
+            std::advance(cut2, len22);
+            cut1 = std::upper_bound(first, mid, *cut2, comp);
+            len11 = std::distance(first, cut1);
+        }
+        BidirectionalIterator new_mid = std::rotate(cut1, mid, cut2);
+        // recurse into the shorter side, loop on the longer one.
+        if (len11 + len22 < (len1 - len11) + (len2 - len22))
+        {
+            merge_without_buffer(first, cut1, new_mid, comp);
+            first = new_mid;
+            mid   = cut2;
+            len1 -= len11;
+            len2 -= len22;
+        }
+        else
+        {
+            merge_without_buffer(new_mid, cut2, last, comp);
+            mid   = cut1;
+            last  = new_mid;
+            len1  = len11;
+            len2  = len22;
+        }
+    }
 }
 
-template <class RandomAccessIterator, class Compare>
+// Merges [first, mid) and [mid, last) by moving the shorter run into 'buf', which is
+// uninitialized storage for min(mid - first, last - mid) elements.
+template <class Compare,
+          class BidirectionalIterator,
+          class ValueType = typename std::iterator_traits<BidirectionalIterator>::value_type>
+void
+merge_with_buffer(BidirectionalIterator first,
+                  BidirectionalIterator mid,
+                  BidirectionalIterator last,
+                  Compare& comp,
+                  ValueType* buf)
+{
+    if (std::distance(first, mid) <= std::distance(mid, last))
+    {
+        ValueType* buf_last = std::uninitialized_move(first, mid, buf);
+        ValueType* left = buf;
+        for (; left != buf_last; ++first)
+        {
+            if (mid == last)
+            {
+                std::move(left, buf_last, first);
+                break;
+            }
+            if (comp(*mid, *left))
+            {
+                *first = std::move(*mid);
+                ++mid;
+            }
+            else
+            {
+                *first = std::move(*left);
+                ++left;
+            }
+        }
+        std::destroy(buf, buf_last);
+    }
+    else
+    {
+        ValueType* buf_last = std::uninitialized_move(mid, last, buf);
+        ValueType* right = buf_last;
+        while (right != buf)
+        {
+            if (mid == first)
+            {
+                std::move_backward(buf, right, last);
+                break;
+            }
+            if (comp(*(right - 1), *prev_iter(mid)))
+                *--last = std::move(*--mid);
+            else
+                *--last = std::move(*--right);
+        }
+        std::destroy(buf, buf_last);
+    }
+}
+
+template <class Compare,
+          class BidirectionalIterator>
+void
+merge_with_arena(BidirectionalIterator first,
+                 BidirectionalIterator mid,
+                 BidirectionalIterator last,
+                 Compare& comp,
+                 scratch_arena& arena)
+{
+    typedef typename std::iterator_traits<BidirectionalIterator>::value_type value_type;
+    scratch_arena::frame frame(arena);
+    const size_t buf_len = static_cast<size_t>(std::min(std::distance(first, mid), std::distance(mid, last)));
+    if (value_type* buf = arena.allocate<value_type>(buf_len))
+        merge_with_buffer(first, mid, last, comp, buf);
+    else
+        merge_without_buffer(first, mid, last, comp);
+}
+
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
 CONSTEXPR_CPP20 inline void
 qsort(const RandomAccessIterator first,
-	  const RandomAccessIterator last,
-	  Compare comp)
+      const RandomAccessIterator last,
+      Compare comp,
+      Observer&& obs);
+
+// Partitions [first, last) of a segmented range around *first, as bitset_partition does,
+// with blocks which never cross a segment: each block is scanned through raw pointers,
+// and the misplaced elements of a left and a right block are swapped pairwise, whatever
+// segments they are in. Returns the final position of the pivot.
+template <class Compare,
+          class SegmentedIterator>
+SegmentedIterator
+segmented_partition(SegmentedIterator first,
+                    SegmentedIterator last,
+                    Compare&& comp)
 {
+    typedef typename std::iterator_traits<SegmentedIterator>::value_type value_type;
+    typedef typename std::iterator_traits<SegmentedIterator>::difference_type difference_type;
+    typedef segment_traits<SegmentedIterator> traits;
+    SORTER_PERF_PHASE(bitset_partition);
+    constexpr difference_type block_size = tuning_of<value_type>::value.block_size;
+    value_type pivot(std::move(*first));
+    // [lo, hi) is not scanned yet. The left block ends at lo and 'left' is its first
+    // element; the right block starts at hi and 'right' is its last element. Bit j of
+    // left_bitset is set if left[j] is not less than the pivot, bit j of right_bitset if
+    // right[-j] is less.
+    SegmentedIterator lo = next_iter(first);
+    SegmentedIterator hi = last;
+    value_type* left  = nullptr;
+    value_type* right = nullptr;
+    difference_type left_len  = 0;
+    difference_type right_len = 0;
+    uint64_t left_bitset  = 0;
+    uint64_t right_bitset = 0;
+    for (;;)
+    {
+        if (left_bitset == 0 && lo != hi)
+        {
+            left = std::addressof(*lo);
+            left_len = std::min({traits::segment_end(lo) - left, hi - lo, block_size});
+            if constexpr (has_compare_block<typename std::remove_cvref<Compare>::type, value_type*>)
+                left_bitset = left_block_bitset(left, static_cast<int>(left_len), comp, pivot);
+            else
+                for (difference_type j = 0; j < left_len; ++j)
+                    left_bitset |= static_cast<uint64_t>(!comp(left[j], pivot)) << j;
+            lo += left_len;
+        }
+        if (right_bitset == 0 && lo != hi)
+        {
+            // the last segment piece of at most a block before hi
+            SegmentedIterator start = hi - std::min(hi - lo, block_size);
+            while (traits::segment_end(start) - std::addressof(*start) < hi - start)
+                start += traits::segment_end(start) - std::addressof(*start);
+            right_len = hi - start;
+            right = std::addressof(*prev_iter(hi));
+            if constexpr (has_compare_block<typename std::remove_cvref<Compare>::type, value_type*>)
+                right_bitset = right_block_bitset(right, static_cast<int>(right_len), comp, pivot);
+            else
+                for (difference_type j = 0; j < right_len; ++j)
+                    right_bitset |= static_cast<uint64_t>(comp(right[-j], pivot)) << j;
+            hi = start;
+        }
+        if (left_bitset != 0 && right_bitset != 0)
+            swap_bitmap_cyclic(left, right, left_bitset, right_bitset);
+        else if (lo == hi)
+            break;
+    }
+
+    // At most one block has misplaced elements left, and it is next to lo; they are
+    // moved to its far side, as in swap_bitmap_pos_within.
+    SegmentedIterator mid = lo;
+    if (left_bitset != 0)
+    {
+        value_type* tail = left + left_len;
+        while (left_bitset != 0)
+        {
+            const int bit = 63 - count_left_zero(left_bitset);
+            left_bitset &= (static_cast<uint64_t>(1) << bit) - 1;
+            std::iter_swap(left + bit, --tail);
+        }
+        mid -= (left + left_len) - tail;
+    }
+    else if (right_bitset != 0)
+    {
+        value_type* const head = right - (right_len - 1);
+        value_type* front = head;
+        while (right_bitset != 0)
+        {
+            const int bit = 63 - count_left_zero(right_bitset);
+            right_bitset &= (static_cast<uint64_t>(1) << bit) - 1;
+            std::iter_swap(right - bit, front++);
+        }
+        mid += front - head;
+    }
+    --mid;
+    *first = std::move(*mid);
+    *mid = std::move(pivot);
+    return mid;
+}
+
+// Small-sorts a range which spans segments through a buffer on the stack, if
+// ssort_max elements fit in max_stack_size.
+template <class Compare,
+          class SegmentedIterator>
+void
+segmented_small_sort(SegmentedIterator first,
+                     SegmentedIterator last,
+                     Compare& comp)
+{
+    typedef typename std::iterator_traits<SegmentedIterator>::value_type value_type;
+    constexpr sort_tuning tuning = tuning_of<value_type>::value;
+    if constexpr (sizeof(value_type) * tuning.ssort_max <= tuning.max_stack_size)
+    {
+        alignas(value_type) unsigned char storage[sizeof(value_type) * tuning.ssort_max];
+        value_type* const buf = reinterpret_cast<value_type*>(storage);
+        value_type* out = buf;
+        for_each_segment(first, last, [&out](value_type* seg_first, value_type* seg_last) {
+            out = std::uninitialized_move(seg_first, seg_last, out);
+        });
+        small_sort(buf, out, comp);
+        value_type* in = buf;
+        for_each_segment(first, last, [&in](value_type* seg_first, value_type* seg_last) {
+            std::move(in, in + (seg_last - seg_first), seg_first);
+            in += seg_last - seg_first;
+        });
+        std::destroy(buf, out);
+    }
+    else
+        small_sort(first, last, comp);
+}
+
+// quick_sort for the ranges of a segmented container: a range within one segment is
+// sorted by quick_sort through raw pointers, the others are split by
+// segmented_partition, and the short ones small-sorted through a bounded buffer. Neither
+// copies the range.
+template <class Compare,
+          class Observer,
+          class SegmentedIterator>
+void
+segmented_quick_sort(SegmentedIterator first,
+                     SegmentedIterator last,
+                     Compare& comp,
+                     Observer& obs,
+                     typename std::iterator_traits<SegmentedIterator>::difference_type depth_limit,
+                     typename std::iterator_traits<SegmentedIterator>::pointer ancestor_pivot)
+{
+    typedef typename std::iterator_traits<SegmentedIterator>::value_type value_type;
+    constexpr sort_tuning tuning = tuning_of<value_type>::value;
+    for (;;)
+    {
+        const auto len = last - first;
+        if (len < 2)
+            return;
+        value_type* const begin = std::addressof(*first);
+        if (segment_traits<SegmentedIterator>::segment_end(first) - begin >= len)
+        {
+            quick_sort(begin, begin + len, comp, obs, depth_limit, ancestor_pivot);
+            return;
+        }
+
+        const auto start = observe_start(obs);
+        if (len <= tuning.ssort_max)
+        {
+            segmented_small_sort(first, last, comp);
+            observe(obs, start, sort_event::small_sort, len);
+            return;
+        }
+        if (depth_limit == 0)
+        {
+            heap_sort(first, last, comp);
+            observe(obs, start, sort_event::heap_fallback, len);
+            return;
+        }
+        --depth_limit;
+
+        if (active_pivot_state != 0) // see pivot_seed
+            shuffle_pivot_sample(first, last, active_pivot_state);
+        choose_pivot(first, last, comp);
+        if (ancestor_pivot && !comp(*ancestor_pivot, *first))
+        {
+            SegmentedIterator mid = segmented_partition(first, last, reverse_predicate{comp});
+            observe(obs, start, sort_event::equal_elements, len, mid - first + 1);
+            ancestor_pivot = nullptr;
+            first = ++mid;
+            continue;
+        }
+
+        SegmentedIterator mid = segmented_partition(first, last, comp);
+        observe(obs, start, sort_event::partition, len, mid - first, partition_kernel::bitset);
+        if (is_unbalanced(len, mid - first))
+        {
+            break_patterns(first, mid);
+            break_patterns(next_iter(mid), last);
+        }
+        segmented_quick_sort(first, mid, comp, obs, depth_limit, ancestor_pivot);
+        ancestor_pivot = std::addressof(*mid);
+        first = ++mid;
+    }
+}
+
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+CONSTEXPR_CPP20 inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      Observer&& obs)
+{
+    if constexpr (is_segmented_iterator<RandomAccessIterator>) // within one segment ==> through raw pointers
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        if (last - first < 2)
+            return;
+        value_type* const begin = std::addressof(*first);
+        if (segment_traits<RandomAccessIterator>::segment_end(first) - begin >= last - first)
+        {
+            qsort(begin, begin + (last - first), comp, obs);
+            return;
+        }
+    }
+    if constexpr (use_wide_key_compare<RandomAccessIterator, Compare>) // 128-bit integers, byte arrays
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        qsort(first, last, wide_key_compare<value_type, is_greater_comparator<typename std::remove_cvref<Compare>::type>>{}, obs);
+        return;
+    }
+    auto start = observe_start(obs);
     const auto [mid, descending] = find_existing_run(first, last, comp);
+    observe(obs, start, sort_event::run_detection, last - first, mid - first);
 
     if (mid == last) // strictly ascending ==> no operation
     {
@@ -496,17 +1345,127 @@ qsort(const RandomAccessIterator first,
             std::reverse(first, last);
         return;
     }
-    else if (mid - first >= last - mid) // first half are sorted, sort last half and merge them
+    if constexpr (use_counting_sort<RandomAccessIterator, Compare>) // small-domain keys
+    {
+        typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+        if (!std::is_constant_evaluated() && last - first >= counting_sort_min_len<value_type> &&
+            counting_sort(first, last, comp, obs))
+            return;
+    }
+    if (mid - first >= last - mid) // first half are sorted, sort last half and merge them
     {
         if (descending)
             std::reverse(first, mid);
-        quick_sort(mid, last, comp, log2i(last - mid) << 1);
-        std::inplace_merge(first, mid, last, comp);
+        quick_sort(mid, last, comp, obs, log2i(last - mid) << 1);
+        start = observe_start(obs);
+        SORTER_IF_CONSTEVAL
+        {
+            merge_without_buffer(first, mid, last, comp);
+        }
+        else
+        {
+            SORTER_PERF_PHASE(inplace_merge);
+            if (active_merge_threads > 1)
+                parallel_merge(first, mid, last, comp, active_merge_threads);
+            else if (scratch_arena* arena = active_scratch_arena)
+                merge_with_arena(first, mid, last, comp, *arena);
+            else
+                std::inplace_merge(first, mid, last, comp);
+        }
+        observe(obs, start, sort_event::merge, last - first, mid - first);
         return;
      }
-     quick_sort(first, last, comp, log2i(last - first) << 1);
+    if constexpr (use_key_narrowing<RandomAccessIterator, Compare>) // 64-bit keys of a narrow span
+    {
+        if (!std::is_constant_evaluated() && last - first >= key_narrowing_min_len &&
+            key_narrowing_sort(first, last, comp, obs))
+            return;
+    }
+     quick_sort(first, last, comp, obs, log2i(last - first) << 1);
 }
 
+template <class RandomAccessIterator, class Compare>
+CONSTEXPR_CPP20 inline void
+qsort(const RandomAccessIterator first,
+	  const RandomAccessIterator last,
+	  Compare comp)
+{ qsort(first, last, comp, null_observer{}); }
+
+// Takes every temporary buffer from 'arena' instead of the heap; see scratch_arena.
+// Pass thread_scratch_arena() to reuse one arena per thread.
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      scratch_arena& arena,
+      Observer&& obs)
+{
+    scratch_arena_scope scope(arena);
+    qsort(first, last, comp, obs);
+}
+
+template <class RandomAccessIterator,
+          class Compare>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      scratch_arena& arena)
+{ qsort(first, last, comp, arena, null_observer{}); }
+
+// Merges the presorted prefix with the sorted rest with up to 'threads.count' threads;
+// see parallel_merge. Combine with scratch_arena_scope to take the merge buffer from an
+// arena.
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      sort_threads threads,
+      Observer&& obs)
+{
+    merge_threads_scope scope(threads);
+    qsort(first, last, comp, obs);
+}
+
+template <class RandomAccessIterator,
+          class Compare>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      sort_threads threads)
+{ qsort(first, last, comp, threads, null_observer{}); }
+
+// Randomizes the pivot samples with 'seed'; see pivot_seed.
+template <class RandomAccessIterator,
+          class Compare,
+          class Observer>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      pivot_seed seed,
+      Observer&& obs)
+{
+    pivot_seed_scope scope(seed);
+    qsort(first, last, comp, obs);
+}
+
+template <class RandomAccessIterator,
+          class Compare>
+inline void
+qsort(const RandomAccessIterator first,
+      const RandomAccessIterator last,
+      Compare comp,
+      pivot_seed seed)
+{ qsort(first, last, comp, seed, null_observer{}); }
+
 template <class RandomAccessIterator>
 CONSTEXPR_CPP20 inline void
 qsort(const RandomAccessIterator first,
@@ -0,0 +1,365 @@
+#ifndef RECORD_SORT_H_INCLUDED
+#define RECORD_SORT_H_INCLUDED
+#include "qsort.h"
+#include <cstddef>
+#include <cstring>
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SORTER_HAS_POSIX_MMAP 1
+#endif
+
+SORTER_BEGIN
+// How the key of a record is stored. Integers and floating-point keys are in the native
+// byte order.
+enum class record_key_type
+{
+    unsigned_integer, // 1, 2, 4 or 8 bytes
+    signed_integer,   // 1, 2, 4 or 8 bytes
+    floating,         // 4 or 8 bytes; -NaN < -inf < ... < -0 < +0 < ... < inf < NaN
+    bytes             // any width, compared as by memcmp
+};
+
+// The layout of the records of sort_records, known only at run time: 'width' bytes per
+// record, keyed by the 'key_width' bytes from 'key_offset' on.
+struct record_layout
+{
+    size_t width;
+    size_t key_offset;
+    size_t key_width;
+    record_key_type key_type;
+};
+
+constexpr bool
+record_layout_valid(const record_layout& layout) noexcept
+{
+    if (layout.width == 0 || layout.key_width == 0 || layout.key_width > layout.width ||
+        layout.key_offset > layout.width - layout.key_width)
+        return false;
+    switch (layout.key_type)
+    {
+    case record_key_type::unsigned_integer:
+    case record_key_type::signed_integer:
+        return layout.key_width == 1 || layout.key_width == 2 || layout.key_width == 4 || layout.key_width == 8;
+    case record_key_type::floating:
+        return layout.key_width == 4 || layout.key_width == 8;
+    case record_key_type::bytes:
+        return true;
+    }
+    return false;
+}
+
+// Loads the key of a record as an unsigned integer in the same order: signed integers
+// get their sign bit flipped ('flip'), floating-point keys their sign bit if positive
+// and every bit if negative.
+template <class UInt,
+          bool Floating>
+struct ordered_record_key
+{
+    size_t offset;
+    UInt flip;
+
+    SORTER_FORCEINLINE
+    UInt operator()(const std::byte* record) const noexcept
+    {
+        constexpr UInt sign = UInt(1) << (8 * sizeof(UInt) - 1);
+        UInt key;
+        std::memcpy(&key, record + offset, sizeof(UInt));
+        if constexpr (Floating)
+            return key ^ (static_cast<UInt>(UInt(0) - (key >> (8 * sizeof(UInt) - 1))) | sign);
+        else
+            return key ^ flip;
+    }
+};
+
+// The first (up to) 8 bytes of a bytes key, big-endian, so that the integers compare as
+// memcmp does; shorter keys are padded with zeros.
+struct record_key_prefix
+{
+    size_t offset;
+    size_t width;
+
+    uint64_t operator()(const std::byte* record) const noexcept
+    {
+        const size_t len = std::min(width, sizeof(uint64_t));
+        uint64_t key = 0;
+        for (size_t k = 0; k < len; ++k)
+            key = key << 8 | static_cast<uint64_t>(record[offset + k]);
+        return len < sizeof(uint64_t) ? key << (8 * (sizeof(uint64_t) - len)) : key;
+    }
+};
+
+// Calls func(key) with the ordered_record_key of a valid integer or floating-point
+// layout, or with the record_key_prefix of a bytes key.
+template <class Function>
+void
+visit_record_key(const record_layout& layout,
+                 Function&& func)
+{
+    const size_t offset = layout.key_offset;
+    const bool is_signed = layout.key_type == record_key_type::signed_integer;
+    if (layout.key_type == record_key_type::bytes)
+        func(record_key_prefix{offset, layout.key_width});
+    else if (layout.key_type == record_key_type::floating)
+    {
+        if (layout.key_width == 4)
+            func(ordered_record_key<uint32_t, true>{offset, 0});
+        else
+            func(ordered_record_key<uint64_t, true>{offset, 0});
+    }
+    else if (layout.key_width == 1)
+        func(ordered_record_key<uint8_t, false>{offset, static_cast<uint8_t>(is_signed ? 0x80u : 0)});
+    else if (layout.key_width == 2)
+        func(ordered_record_key<uint16_t, false>{offset, static_cast<uint16_t>(is_signed ? 0x8000u : 0)});
+    else if (layout.key_width == 4)
+        func(ordered_record_key<uint32_t, false>{offset, is_signed ? uint32_t(1) << 31 : 0});
+    else
+        func(ordered_record_key<uint64_t, false>{offset, is_signed ? uint64_t(1) << 63 : 0});
+}
+
+// A record of a width known at compile time, sorted in place by the specialized kernels.
+template <size_t Width>
+struct record_bytes
+{
+    std::byte bytes[Width];
+};
+
+template <size_t Width,
+          class Key>
+struct record_less
+{
+    Key key;
+
+    SORTER_FORCEINLINE
+    bool operator()(const record_bytes<Width>& a, const record_bytes<Width>& b) const noexcept
+    { return key(a.bytes) < key(b.bytes); }
+
+    // Branch-free blocks for bitset_partition.
+    uint64_t compare_block(const record_bytes<Width>* first, int count, const record_bytes<Width>& pivot) const noexcept
+    {
+        const auto pivot_key = key(pivot.bytes);
+        uint64_t mask = 0;
+        for (int j = 0; j < count; ++j)
+            mask |= static_cast<uint64_t>(key(first[j].bytes) < pivot_key) << j;
+        return mask;
+    }
+};
+
+template <size_t Width,
+          class Key>
+void
+sort_records_as(std::byte* data,
+                size_t count,
+                const Key& key)
+{
+    record_bytes<Width>* const first = reinterpret_cast<record_bytes<Width>*>(data);
+    qsort(first, first + count, record_less<Width, Key>{key});
+}
+
+// The side array of the other layouts: the ordered key, or bytes key prefix, of a
+// record and its index.
+struct record_ref
+{
+    uint64_t key;
+    size_t index;
+};
+
+struct record_ref_less
+{
+    SORTER_FORCEINLINE
+    bool operator()(const record_ref& a, const record_ref& b) const noexcept
+    { return a.key < b.key; }
+
+    uint64_t compare_block(const record_ref* first, int count, const record_ref& pivot) const noexcept
+    {
+        uint64_t mask = 0;
+        for (int j = 0; j < count; ++j)
+            mask |= static_cast<uint64_t>(first[j].key < pivot.key) << j;
+        return mask;
+    }
+};
+
+// Bytes keys longer than the prefix break its ties with memcmp on the records.
+struct record_ref_bytes_less
+{
+    const std::byte* data;
+    size_t width;
+    size_t offset;
+    size_t key_width;
+
+    bool operator()(const record_ref& a, const record_ref& b) const noexcept
+    {
+        if (a.key != b.key)
+            return a.key < b.key;
+        return std::memcmp(data + a.index * width + offset, data + b.index * width + offset, key_width) < 0;
+    }
+};
+
+// Moves the records into the order of the sorted side array, a cycle at a time through
+// 'tmp'. Needs no more memory, but every step waits for the load of the previous one.
+inline void
+permute_records(std::byte* data,
+                size_t width,
+                record_ref* refs,
+                size_t count,
+                std::byte* tmp) noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t src = refs[i].index;
+        if (src == i)
+            continue;
+        std::memcpy(tmp, data + i * width, width);
+        size_t dst = i;
+        do
+        {
+            std::memcpy(data + dst * width, data + src * width, width);
+            refs[dst].index = dst;
+            dst = src;
+            src = refs[dst].index;
+        } while (src != i);
+        std::memcpy(data + dst * width, tmp, width);
+        refs[dst].index = dst;
+    }
+}
+
+// As permute_records, gathering the records into 'buf' in their sorted order, then
+// copying them back. The loads are independent and prefetched, which is several times
+// faster than following the cycles.
+inline void
+gather_records(std::byte* data,
+               size_t width,
+               const record_ref* refs,
+               size_t count,
+               std::byte* buf) noexcept
+{
+    constexpr size_t PREFETCH_DISTANCE = 16;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < count)
+            SORTER_PREFETCH(data + refs[i + PREFETCH_DISTANCE].index * width);
+        std::memcpy(buf + i * width, data + refs[i].index * width, width);
+    }
+    std::memcpy(data, buf, count * width);
+}
+
+// Sorts the records through a side array of keys and indices; false if the side array
+// cannot be allocated. With 'gather', the records are gathered through a copy of them if
+// the scratch memory allows; otherwise they are moved along the cycles of the
+// permutation.
+inline bool
+sort_record_refs(std::byte* data,
+                 size_t count,
+                 const record_layout& layout,
+                 bool gather)
+{
+    const size_t refs_bytes = count * sizeof(record_ref) + layout.width + scratch_arena::ALIGNMENT;
+    scoped_scratch scratch;
+    if (!gather || !scratch.reserve(refs_bytes + count * layout.width))
+        scratch.reserve(refs_bytes);
+    record_ref* const refs = scratch.allocate<record_ref>(count);
+    std::byte* const tmp = scratch.allocate<std::byte>(layout.width);
+    if (refs == nullptr || tmp == nullptr)
+        return false;
+    std::byte* const buf = gather ? scratch.allocate<std::byte>(count * layout.width) : nullptr;
+    visit_record_key(layout, [&](const auto& key) {
+        for (size_t i = 0; i < count; ++i)
+            refs[i] = record_ref{static_cast<uint64_t>(key(data + i * layout.width)), i};
+    });
+    if (layout.key_type == record_key_type::bytes && layout.key_width > sizeof(uint64_t))
+        qsort(refs, refs + count, record_ref_bytes_less{data, layout.width, layout.key_offset, layout.key_width});
+    else
+        qsort(refs, refs + count, record_ref_less{});
+    if (buf != nullptr)
+        gather_records(data, layout.width, refs, count, buf);
+    else
+        permute_records(data, layout.width, refs, count, tmp);
+    return true;
+}
+
+// sort_records; 'gather' as for sort_record_refs.
+inline bool
+sort_records_with(std::byte* data,
+                  size_t count,
+                  const record_layout& layout,
+                  bool gather)
+{
+    if (!record_layout_valid(layout))
+        return false;
+    if (count < 2)
+        return true;
+    if (layout.key_type == record_key_type::bytes)
+        return sort_record_refs(data, count, layout, gather);
+    bool sorted = true;
+    visit_record_key(layout, [&](const auto& key) {
+        switch (layout.width)
+        {
+        case 8:   sort_records_as<8>(data, count, key);   break;
+        case 16:  sort_records_as<16>(data, count, key);  break;
+        case 32:  sort_records_as<32>(data, count, key);  break;
+        case 64:  sort_records_as<64>(data, count, key);  break;
+        case 128: sort_records_as<128>(data, count, key); break;
+        default:  sorted = sort_record_refs(data, count, layout, gather); break;
+        }
+    });
+    return sorted;
+}
+
+// Sorts the 'count' records of 'layout' stored back to back at 'data', by their key,
+// in place; equal keys end up in no particular order. Records of 8, 16, 32, 64 or 128
+// bytes with an integer or floating-point key are sorted as such by qsort. The others,
+// and bytes keys, go through a side array of 16 bytes per record: the keys (up to 8 bytes
+// of a bytes key, with memcmp for the rest) and indices are sorted, and the records are
+// moved into their place, through a scratch copy of them when it can be allocated.
+// Returns false, with the records untouched, if the layout is not valid or the side
+// array cannot be allocated.
+inline bool
+sort_records(std::byte* data,
+             size_t count,
+             const record_layout& layout)
+{ return sort_records_with(data, count, layout, true); }
+
+#ifdef SORTER_HAS_POSIX_MMAP
+// Sorts the records of the file at 'path' in place through a shared mapping, without
+// reading it into memory first; the page cache writes the sorted records back. Records
+// sorted through the side array are moved along the cycles of the permutation rather
+// than gathered through a copy, which would double the memory used for the file. Returns
+// false if the file cannot be opened or mapped, its size is not a multiple of
+// layout.width, or sort_records fails.
+inline bool
+sort_record_file(const char* path,
+                 const record_layout& layout)
+{
+    if (!record_layout_valid(layout))
+        return false;
+    const int fd = ::open(path, O_RDWR);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) % layout.width != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    if (bytes == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+    void* const map = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+#ifdef MADV_WILLNEED
+    ::madvise(map, bytes, MADV_WILLNEED);
+#endif
+    const bool sorted = sort_records_with(static_cast<std::byte*>(map), bytes / layout.width, layout, false);
+    ::munmap(map, bytes);
+    return sorted;
+}
+#endif // SORTER_HAS_POSIX_MMAP
+SORTER_END
+#endif // RECORD_SORT_H_INCLUDED
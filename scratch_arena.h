@@ -0,0 +1,159 @@
+#ifndef SCRATCH_ARENA_H_INCLUDED
+#define SCRATCH_ARENA_H_INCLUDED
+#include "sort_aux.h"
+#include <new>
+
+SORTER_BEGIN
+// Reusable scratch memory for the temporary buffers of a sort. Allocations are bumped
+// off one block and released in LIFO order through scratch_arena::frame. An owning
+// arena grows to the largest demand it has seen once it is idle again, so repeated
+// sorts of similar inputs stop allocating after the first one. An arena over caller
+// storage never allocates; requests that do not fit return nullptr and the sorter
+// falls back to an allocation-free algorithm.
+class scratch_arena
+{
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    scratch_arena() noexcept = default;
+
+    explicit scratch_arena(size_t bytes)
+    { grow(bytes); }
+
+    scratch_arena(void* storage, size_t bytes) noexcept
+        : data_(static_cast<unsigned char*>(storage)), capacity_(bytes), owner_(false)
+    {}
+
+    scratch_arena(const scratch_arena&) = delete;
+    scratch_arena& operator=(const scratch_arena&) = delete;
+
+    ~scratch_arena()
+    { release_storage(); }
+
+    // Raw, uninitialized storage for 'count' objects of type Tp, or nullptr.
+    template <class Tp>
+    Tp* allocate(size_t count) noexcept
+    {
+        static_assert(alignof(Tp) <= ALIGNMENT, "over-aligned types are not supported");
+        const size_t bytes = count * sizeof(Tp);
+        if (used_ == 0 && owner_ && wanted_ > capacity_)
+            grow(wanted_);
+        const uintptr_t base  = reinterpret_cast<uintptr_t>(data_);
+        const size_t    start = static_cast<size_t>(((base + used_ + alignof(Tp) - 1) & ~uintptr_t(alignof(Tp) - 1)) - base);
+        if (data_ == nullptr || start + bytes > capacity_)
+        {
+            wanted_ = std::max(wanted_, start + bytes);
+            if (used_ != 0 || !owner_ || !grow(wanted_))
+                return nullptr;
+            return allocate<Tp>(count);
+        }
+        used_ = start + bytes;
+        return reinterpret_cast<Tp*>(data_ + start);
+    }
+
+    size_t capacity() const noexcept
+    { return capacity_; }
+
+    bool reserve(size_t bytes) noexcept
+    { return bytes <= capacity_ || (used_ == 0 && owner_ && grow(bytes)); }
+
+    // Releases everything allocated during its lifetime.
+    class frame
+    {
+    public:
+        explicit frame(scratch_arena& arena) noexcept
+            : arena_(arena), mark_(arena.used_)
+        {}
+
+        ~frame()
+        { arena_.used_ = mark_; }
+
+        frame(const frame&) = delete;
+        frame& operator=(const frame&) = delete;
+
+    private:
+        scratch_arena& arena_;
+        size_t mark_;
+    };
+
+private:
+    bool grow(size_t bytes) noexcept
+    {
+        void* storage = ::operator new(bytes, std::align_val_t(ALIGNMENT), std::nothrow);
+        if (storage == nullptr)
+            return false;
+        release_storage();
+        data_     = static_cast<unsigned char*>(storage);
+        capacity_ = bytes;
+        return true;
+    }
+
+    void release_storage() noexcept
+    {
+        if (owner_ && data_ != nullptr)
+            ::operator delete(data_, std::align_val_t(ALIGNMENT));
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+
+    unsigned char* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+    size_t wanted_ = 0;
+    bool owner_ = true;
+};
+
+// The arena of the sort running on this thread, if it was given one.
+INLINE_VAR thread_local scratch_arena* active_scratch_arena = nullptr;
+
+// The scratch memory of one algorithm: the active arena of this thread, or an arena of
+// its own if there is none, with a frame releasing everything allocated through it.
+class scoped_scratch
+{
+public:
+    scoped_scratch() noexcept
+        : arena_(active_scratch_arena ? *active_scratch_arena : local_), frame_(arena_)
+    {}
+
+    scoped_scratch(const scoped_scratch&) = delete;
+    scoped_scratch& operator=(const scoped_scratch&) = delete;
+
+    template <class Tp>
+    Tp* allocate(size_t count) noexcept
+    { return arena_.allocate<Tp>(count); }
+
+    bool reserve(size_t bytes) noexcept
+    { return arena_.reserve(bytes); }
+
+private:
+    scratch_arena local_;
+    scratch_arena& arena_;
+    scratch_arena::frame frame_;
+};
+
+// A per-thread arena which callers can hand to qsort to reuse its memory across sorts.
+inline scratch_arena& thread_scratch_arena() noexcept
+{
+    static thread_local scratch_arena arena;
+    return arena;
+}
+
+// Makes 'arena' the active arena of this thread for its lifetime.
+class scratch_arena_scope
+{
+public:
+    explicit scratch_arena_scope(scratch_arena& arena) noexcept
+        : previous_(active_scratch_arena)
+    { active_scratch_arena = &arena; }
+
+    ~scratch_arena_scope()
+    { active_scratch_arena = previous_; }
+
+    scratch_arena_scope(const scratch_arena_scope&) = delete;
+    scratch_arena_scope& operator=(const scratch_arena_scope&) = delete;
+
+private:
+    scratch_arena* previous_;
+};
+SORTER_END
+#endif // SCRATCH_ARENA_H_INCLUDED
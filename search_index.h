@@ -0,0 +1,170 @@
+#ifndef SEARCH_INDEX_H_INCLUDED
+#define SEARCH_INDEX_H_INCLUDED
+#include "qsort.h"
+#include <new>
+
+SORTER_BEGIN
+// A sorted sequence stored in Eytzinger (BFS) order: the children of node k are 2k and
+// 2k + 1, and node 1 is the root. The first levels of the tree share a few cache lines,
+// and the descent from node k only ever touches the 2^d nodes from k * 2^d on, so
+// lower_bound can prefetch the cache line needed several levels ahead and pick each
+// child without a branch. Built by build_search_index().
+template <class Tp,
+          class Compare = std::less<Tp>>
+class search_index
+{
+public:
+    typedef Tp value_type;
+    typedef const Tp* const_iterator;
+
+    // Nodes per cache line; lower_bound prefetches the 16th descendants of a node.
+    static constexpr size_t LINE_NODES = sizeof(Tp) < 64 ? 64 / sizeof(Tp) : 1;
+
+    search_index() noexcept = default;
+
+    // Builds the layout from the sorted range [first, last).
+    template <class InputIterator>
+    search_index(InputIterator first,
+                 InputIterator last,
+                 Compare comp = Compare{})
+        : comp_(comp)
+    {
+        size_ = static_cast<size_t>(std::distance(first, last));
+        if (size_ == 0)
+            return;
+        // node 0 is unused, so node k * LINE_NODES starts a cache line.
+        nodes_ = static_cast<Tp*>(::operator new((size_ + 1) * sizeof(Tp), std::align_val_t(ALIGNMENT)));
+        fill(first);
+    }
+
+    search_index(search_index&& other) noexcept
+        : nodes_(std::exchange(other.nodes_, nullptr)), size_(std::exchange(other.size_, 0)), comp_(other.comp_)
+    {}
+
+    search_index& operator=(search_index&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            nodes_ = std::exchange(other.nodes_, nullptr);
+            size_  = std::exchange(other.size_, 0);
+            comp_  = other.comp_;
+        }
+        return *this;
+    }
+
+    search_index(const search_index&) = delete;
+    search_index& operator=(const search_index&) = delete;
+
+    ~search_index()
+    { release(); }
+
+    size_t size() const noexcept
+    { return size_; }
+
+    bool empty() const noexcept
+    { return size_ == 0; }
+
+    // The nodes in layout order, i.e. not sorted.
+    const_iterator begin() const noexcept
+    { return nodes_ ? nodes_ + 1 : nullptr; }
+
+    const_iterator end() const noexcept
+    { return nodes_ ? nodes_ + 1 + size_ : nullptr; }
+
+    // The first element which is not less than 'key', or end() if there is none.
+    template <class Key>
+    const_iterator lower_bound(const Key& key) const
+    {
+        size_t k = 1;
+        while (k <= size_)
+        {
+            SORTER_PREFETCH(nodes_ + k * LINE_NODES);
+            k = (k << 1) + static_cast<size_t>(comp_(nodes_[k], key));
+        }
+        // the path ends with one right turn per trailing one bit, after the last left turn
+        // at the answer.
+        k >>= count_tail_zero(~k) + 1;
+        return k != 0 ? nodes_ + k : end();
+    }
+
+    // The first element which 'key' is less than, or end() if there is none.
+    template <class Key>
+    const_iterator upper_bound(const Key& key) const
+    {
+        size_t k = 1;
+        while (k <= size_)
+        {
+            SORTER_PREFETCH(nodes_ + k * LINE_NODES);
+            k = (k << 1) + static_cast<size_t>(!comp_(key, nodes_[k]));
+        }
+        k >>= count_tail_zero(~k) + 1;
+        return k != 0 ? nodes_ + k : end();
+    }
+
+    template <class Key>
+    bool contains(const Key& key) const
+    {
+        const_iterator it = lower_bound(key);
+        return it != end() && !comp_(key, *it);
+    }
+
+private:
+    static constexpr size_t ALIGNMENT = 64;
+
+    // Copies the sorted input into the nodes by an in-order walk of the tree.
+    template <class InputIterator>
+    void fill(InputIterator& it)
+    {
+        size_t k = 1;
+        for (;;)
+        {
+            while (k <= size_) // leftmost descendant first
+                k <<= 1;
+            k >>= count_tail_zero(~k) + 1; // back up to the next node in order
+            if (k == 0)
+                return;
+            ::new (static_cast<void*>(nodes_ + k)) Tp(*it);
+            ++it;
+            k = (k << 1) + 1;
+        }
+    }
+
+    void release() noexcept
+    {
+        if (nodes_ == nullptr)
+            return;
+        std::destroy(nodes_ + 1, nodes_ + 1 + size_);
+        ::operator delete(nodes_, std::align_val_t(ALIGNMENT));
+        nodes_ = nullptr;
+        size_  = 0;
+    }
+
+    Tp* nodes_ = nullptr;
+    size_t size_ = 0;
+    Compare comp_{};
+};
+
+// Sorts [first, last) with qsort and builds a search_index over the result; the range
+// stays sorted.
+template <class RandomAccessIterator,
+          class Compare>
+inline search_index<typename std::iterator_traits<RandomAccessIterator>::value_type, Compare>
+build_search_index(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Compare comp)
+{
+    qsort(first, last, comp);
+    return search_index<typename std::iterator_traits<RandomAccessIterator>::value_type, Compare>(first, last, comp);
+}
+
+template <class RandomAccessIterator>
+inline search_index<typename std::iterator_traits<RandomAccessIterator>::value_type>
+build_search_index(RandomAccessIterator first,
+                   RandomAccessIterator last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    return build_search_index(first, last, std::less<value_type>{});
+}
+SORTER_END
+#endif // SEARCH_INDEX_H_INCLUDED
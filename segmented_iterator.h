@@ -0,0 +1,63 @@
+#ifndef SEGMENTED_ITERATOR_H_INCLUDED
+#define SEGMENTED_ITERATOR_H_INCLUDED
+#include "sort_aux.h"
+#include <deque>
+
+SORTER_BEGIN
+// Describes iterators over containers made of contiguous segments, such as std::deque.
+// A chunked container opts in by specializing segment_traits for its iterator:
+//
+//     template <>
+//     struct sorter::segment_traits<my_chunked_iterator>
+//     {
+//         static constexpr bool is_segmented = true;
+//         // one past the last element of the contiguous segment holding *it
+//         static value_type* segment_end(const my_chunked_iterator& it) noexcept;
+//     };
+//
+// qsort then sorts a range within one segment through raw pointers, partitions longer
+// ones by blocks which never cross a segment, and small-sorts short ranges spanning
+// segments through a stack buffer.
+template <class Iter>
+struct segment_traits
+{
+    static constexpr bool is_segmented = false;
+};
+
+#if defined(__GLIBCXX__)
+template <class Tp>
+struct segment_traits<std::_Deque_iterator<Tp, Tp&, Tp*>>
+{
+    static constexpr bool is_segmented = true;
+
+    static Tp* segment_end(const std::_Deque_iterator<Tp, Tp&, Tp*>& it) noexcept
+    { return it._M_last; }
+};
+#endif // libstdc++
+
+template <class Iter>
+constexpr bool is_segmented_iterator = segment_traits<Iter>::is_segmented;
+
+// Calls func(begin, end) with the raw pointers of every contiguous piece of
+// [first, last), in order.
+template <class SegmentedIterator,
+          class Function>
+inline void
+for_each_segment(SegmentedIterator first,
+                 const SegmentedIterator last,
+                 Function&& func)
+{
+    typedef typename std::iterator_traits<SegmentedIterator>::difference_type difference_type;
+    for (difference_type remaining = last - first; remaining > 0;)
+    {
+        auto* begin = std::addressof(*first);
+        auto* end   = segment_traits<SegmentedIterator>::segment_end(first);
+        if (end - begin > remaining)
+            end = begin + remaining;
+        func(begin, end);
+        first     += static_cast<difference_type>(end - begin);
+        remaining -= static_cast<difference_type>(end - begin);
+    }
+}
+SORTER_END
+#endif // SEGMENTED_ITERATOR_H_INCLUDED
@@ -0,0 +1,156 @@
+#ifndef SEGMENTED_SORT_H_INCLUDED
+#define SEGMENTED_SORT_H_INCLUDED
+#include "qsort.h"
+#include <atomic>
+
+SORTER_BEGIN
+// The segments are handed to the threads in batches of consecutive segments holding
+// about this many elements.
+INLINE_VAR constexpr ptrdiff_t SEGMENTED_SORT_BATCH_LEN = 1 << 15;
+// With several threads, a segment of at least this many elements and of more than its
+// share of the total is sorted by all the threads together.
+INLINE_VAR constexpr ptrdiff_t SEGMENTED_SORT_HUGE_MIN = 1 << 17;
+
+// Sorts [first, last) with 'threads' threads: each sorts a slice with quick_sort, then
+// the sorted slices are merged pairwise with parallel_merge.
+template <class RandomAccessIterator,
+          class Compare>
+void
+parallel_quick_sort(RandomAccessIterator first,
+                    RandomAccessIterator last,
+                    Compare& comp,
+                    unsigned threads)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
+    const difference_type len = last - first;
+    threads = static_cast<unsigned>(std::min(static_cast<difference_type>(threads),
+                                             std::max(difference_type(1), len / PARALLEL_MERGE_MIN_SLICE)));
+    auto bound = [len, threads](unsigned k) {
+        return static_cast<difference_type>(static_cast<uint64_t>(len) * k / threads);
+    };
+    auto sort_slice = [&](unsigned k) {
+        Compare slice_comp = comp;
+        null_observer obs;
+        const difference_type slice_len = bound(k + 1) - bound(k);
+        quick_sort(first + bound(k), first + bound(k + 1), slice_comp, obs, log2i(slice_len) << 1);
+    };
+    run_parallel(threads, sort_slice);
+
+    // one buffer for every merge; parallel_merge finds its own if this fails.
+    scoped_scratch scratch;
+    value_type* const buf = scratch.allocate<value_type>(static_cast<size_t>(len));
+    for (unsigned width = 1; width < threads; width <<= 1)
+        for (unsigned k = 0; k + width < threads; k += width << 1)
+        {
+            const unsigned k_last = std::min(k + (width << 1), threads);
+            parallel_merge(first + bound(k), first + bound(k + width), first + bound(k_last), comp, threads,
+                           buf ? buf + bound(k) : nullptr);
+        }
+}
+
+// Sorts every segment [values + offsets[k], values + offsets[k + 1]) of a CSR layout,
+// given the offsets [offsets_first, offsets_last), with up to 'threads.count' threads.
+//
+// The segments are cut into batches of about SEGMENTED_SORT_BATCH_LEN elements, which
+// the threads take from a shared counter as they finish the previous one. Within a
+// batch, the segments are binned by length: the ones up to ssort_max elements are
+// sorted first, back to back with the small-sort kernel (the sorting network for small
+// trivial types), then the longer ones with quick_sort. Neither goes through qsort's
+// run detection and dispatch. Huge segments (see SEGMENTED_SORT_HUGE_MIN) are skipped
+// by the batches and sorted afterwards by all the threads together with
+// parallel_quick_sort. The comparator is called concurrently.
+template <class RandomAccessIterator,
+          class OffsetIterator,
+          class Compare>
+void
+segmented_sort(const RandomAccessIterator values,
+               const OffsetIterator offsets_first,
+               const OffsetIterator offsets_last,
+               Compare comp,
+               sort_threads threads = sort_threads{1})
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    const ptrdiff_t segments = std::max(std::distance(offsets_first, offsets_last), ptrdiff_t(1)) - 1;
+    if (segments <= 0)
+        return;
+    const unsigned thread_count = std::max(threads.count, 1u);
+    auto offset = [&offsets_first](ptrdiff_t k) { return static_cast<ptrdiff_t>(offsets_first[k]); };
+    const ptrdiff_t total = offset(segments) - offset(0);
+    const ptrdiff_t huge_len = thread_count > 1
+                             ? std::max(SEGMENTED_SORT_HUGE_MIN, total / thread_count)
+                             : PTRDIFF_MAX;
+
+    std::vector<ptrdiff_t> batches(1, 0); // first segment of each batch
+    std::vector<ptrdiff_t> huge;
+    ptrdiff_t batch_len = 0;
+    for (ptrdiff_t k = 0; k < segments; ++k)
+    {
+        const ptrdiff_t len = offset(k + 1) - offset(k);
+        if (len >= huge_len)
+            huge.push_back(k);
+        else if ((batch_len += len) >= SEGMENTED_SORT_BATCH_LEN)
+        {
+            batches.push_back(k + 1);
+            batch_len = 0;
+        }
+    }
+    if (batches.back() != segments)
+        batches.push_back(segments);
+
+    constexpr ptrdiff_t ssort_max = tuning_of<value_type>::value.ssort_max;
+    std::atomic<size_t> next_batch(0);
+    auto sort_batches = [&](unsigned) {
+        Compare thread_comp = comp;
+        null_observer obs;
+        for (size_t b; (b = next_batch.fetch_add(1, std::memory_order_relaxed)) + 1 < batches.size();)
+        {
+            const ptrdiff_t k_first = batches[b];
+            const ptrdiff_t k_last  = batches[b + 1];
+            // the short segments first, with the kernel looked up once
+            if constexpr (use_sorting_network<RandomAccessIterator, Compare>)
+            {
+                const auto network = cpu_dispatched<small_sort_network_kernels<Compare, RandomAccessIterator>>();
+                for (ptrdiff_t k = k_first; k < k_last; ++k)
+                {
+                    const ptrdiff_t len = offset(k + 1) - offset(k);
+                    if (len > 1 && len <= ssort_max)
+                        network(values + offset(k), values + offset(k + 1), thread_comp);
+                }
+            }
+            else
+            {
+                for (ptrdiff_t k = k_first; k < k_last; ++k)
+                {
+                    const ptrdiff_t len = offset(k + 1) - offset(k);
+                    if (len > 1 && len <= ssort_max)
+                        small_sort(values + offset(k), values + offset(k + 1), thread_comp);
+                }
+            }
+            for (ptrdiff_t k = k_first; k < k_last; ++k)
+            {
+                const ptrdiff_t len = offset(k + 1) - offset(k);
+                if (len > ssort_max && len < huge_len)
+                    quick_sort(values + offset(k), values + offset(k + 1), thread_comp, obs, log2i(len) << 1);
+            }
+        }
+    };
+    const size_t batch_count = batches.size() - 1;
+    run_parallel(static_cast<unsigned>(std::min<size_t>(thread_count, batch_count)), sort_batches);
+
+    for (ptrdiff_t k : huge)
+        parallel_quick_sort(values + offset(k), values + offset(k + 1), comp, thread_count);
+}
+
+template <class RandomAccessIterator,
+          class OffsetIterator>
+inline void
+segmented_sort(const RandomAccessIterator values,
+               const OffsetIterator offsets_first,
+               const OffsetIterator offsets_last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    segmented_sort(values, offsets_first, offsets_last, std::less<value_type>{});
+}
+SORTER_END
+#endif // SEGMENTED_SORT_H_INCLUDED
@@ -1,6 +1,9 @@
 #ifndef SMALL_SORT_H_INCLUDED
 #define SMALL_SORT_H_INCLUDED
 #include "sort_aux.h"
+#include "cpu_dispatch.h"
+#include "perf_profile.h"
+#include "scratch_arena.h"
 SORTER_BEGIN
 // Branchless swap; compiler likely generates CMOV to avoid branching penalties.
 struct conditional_swap_fn
@@ -206,6 +209,7 @@ insertion_sort(BidirectionalIterator first,
 {
     if (first != last)
     {
+        prefetch_element_targets<Compare>(first, last);
         for (BidirectionalIterator mid = first; ++mid != last;)
         {
             BidirectionalIterator hole = mid;
@@ -305,7 +309,7 @@ sort1to8(RandomAccessIterator first,
 
 template <class Compare,
           class RandomAccessIterator>
-CONSTEXPR_CPP20 void
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
 enforce_order(RandomAccessIterator first,
               RandomAccessIterator last,
               Compare& comp)
@@ -395,10 +399,10 @@ backward_merge(InputIterator first,
 
 template <class Compare,
           class RandomAccessIterator>
-CONSTEXPR_CPP20 inline void
-small_sort_network(RandomAccessIterator first,
-                   RandomAccessIterator last,
-                   Compare& comp)
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
+small_sort_network_kernel(RandomAccessIterator first,
+                          RandomAccessIterator last,
+                          Compare& comp)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
@@ -427,7 +431,56 @@ small_sort_network(RandomAccessIterator first,
     }
 }
 
+// small_sort_network_kernel built once per instruction set.
 template <class Compare,
+          class RandomAccessIterator>
+struct small_sort_network_kernels
+{
+    typedef void (*function)(RandomAccessIterator, RandomAccessIterator, Compare&);
+
+    static void scalar(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { small_sort_network_kernel(first, last, comp); }
+#if SORTER_CPU_DISPATCH
+    SORTER_TARGET_AVX2
+    static void avx2(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { small_sort_network_kernel(first, last, comp); }
+
+    SORTER_TARGET_AVX512
+    static void avx512(RandomAccessIterator first, RandomAccessIterator last, Compare& comp)
+    { small_sort_network_kernel(first, last, comp); }
+#endif
+};
+
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 inline void
+small_sort_network(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Compare& comp)
+{
+    SORTER_IF_CONSTEVAL
+    {
+        small_sort_network_kernel(first, last, comp);
+        return;
+    }
+    cpu_dispatched<small_sort_network_kernels<Compare, RandomAccessIterator>>()(first, last, comp);
+}
+
+template <class OpPolicy,
+          class InputIterator,
+          class OutputIterator>
+CONSTEXPR_CPP20 inline OutputIterator
+move_range(InputIterator first,
+           const InputIterator last,
+           OutputIterator dest)
+{
+    for (; first != last; ++first, ++dest)
+        OpPolicy::op(*dest, std::move(*first));
+    return dest;
+}
+
+template <class OpPolicy,
+          class Compare,
           class InputIterator,
           class OutputIterator>
 CONSTEXPR_CPP20 OutputIterator
@@ -441,25 +494,25 @@ merge_move(InputIterator first,
     {
         if (comp(*next, *first))
         {
-            *dest = std::move(*next);
+            OpPolicy::op(*dest, std::move(*next));
             ++dest;
             ++next;
             if (next == last)
-                return std::move(first, mid, dest);
+                return move_range<OpPolicy>(first, mid, dest);
         }
         else
         {
-            *dest = std::move(*first);
+            OpPolicy::op(*dest, std::move(*first));
             ++dest;
             ++first;
             if (first == mid)
-                return std::move(next, last, dest);
+                return move_range<OpPolicy>(next, last, dest);
         }
     }
 }
 
 template <class Iter>
-CONSTEXPR_CPP20 __forceinline Iter&
+CONSTEXPR_CPP20 SORTER_FORCEINLINE Iter&
 select(bool cond, Iter& a, Iter& b) noexcept // select iterator by cond
 { return cond ? a : b; }
 
@@ -523,8 +576,8 @@ sort8_stable(RandomAccessIterator first,
 {
     sort4_stable(first, scratch_base, comp);
     sort4_stable(first + 4, scratch_base + 4, comp);
-    // scratch_base[0...8] is now initialized, allowing us to merge back to dst
-    merge_move(scratch_base, scratch_base + 4, scratch_base + 8, dst, comp);
+    // scratch_base[0...8] is now initialized, allowing us to merge into dst
+    merge_move<construct>(scratch_base, scratch_base + 4, scratch_base + 8, dst, comp);
 }
 
 template <class Compare,
@@ -532,7 +585,8 @@ template <class Compare,
 CONSTEXPR_CPP20 void
 small_sort_general(RandomAccessIterator first,
                    RandomAccessIterator last,
-                   Compare& comp)
+                   Compare& comp,
+                   typename std::iterator_traits<RandomAccessIterator>::value_type* temp_buf)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::difference_type difference_type;
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
@@ -541,8 +595,9 @@ small_sort_general(RandomAccessIterator first,
     if (len < 2)
         return;
 
-    __builtin_assume(SMALL_SORT_GENERAL_SCRATCH_LEN >= len + 16);
-    value_type temp_buf[SMALL_SORT_GENERAL_SCRATCH_LEN]; // uninitialized
+    prefetch_element_targets<Compare>(first, last);
+    // temp_buf is uninitialized storage for small_sort_general_scratch_len elements
+    SORTER_ASSUME(small_sort_general_scratch_len<value_type> >= len + 16);
     const difference_type half    = len >> 1;
     difference_type presorted_len = 1;
 
@@ -578,10 +633,22 @@ small_sort_general(RandomAccessIterator first,
         }
     }
     // temp_buf[0...len] is now initialized, allowing us to merge back to first
-    merge_move(temp_buf, temp_buf + half, temp_buf + len, first, comp);
+    merge_move<move_assign>(temp_buf, temp_buf + half, temp_buf + len, first, comp);
     std::destroy_n(temp_buf, len); // destroy temp_buf[0...len]
 }
 
+template <class Compare,
+          class RandomAccessIterator>
+CONSTEXPR_CPP20 inline void
+small_sort_general(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   Compare& comp)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    alignas(value_type) unsigned char storage[sizeof(value_type) * small_sort_general_scratch_len<value_type>];
+    small_sort_general(first, last, comp, reinterpret_cast<value_type*>(storage));
+}
+
 template <class Compare,
           class RandomAccessIterator>
 CONSTEXPR_CPP20 inline void
@@ -590,12 +657,29 @@ small_sort(RandomAccessIterator first,
            Compare& comp)
 {
     typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    SORTER_PERF_PHASE(small_sort);
+    SORTER_IF_CONSTEVAL // the scratch buffers below rely on placement new
+    {
+        insertion_sort(first, last, comp);
+        return;
+    }
     if constexpr (use_sorting_network<RandomAccessIterator, Compare>) // for small and trivial types
         small_sort_network(first, last, comp);
-    else if constexpr (sizeof(value_type) * SMALL_SORT_GENERAL_SCRATCH_LEN <= MAX_STACK_SIZE) // for median types
+    else if constexpr (sizeof(value_type) * small_sort_general_scratch_len<value_type> <= tuning_of<value_type>::value.max_stack_size) // for median types
         small_sort_general(first, last, comp);
-    else // if the 'value_type' is very large, fall back to insertionsort
+    else // if the 'value_type' is very large, use the active arena or fall back to insertionsort
+    {
+        if (scratch_arena* arena = active_scratch_arena)
+        {
+            scratch_arena::frame frame(*arena);
+            if (value_type* temp_buf = arena->allocate<value_type>(small_sort_general_scratch_len<value_type>))
+            {
+                small_sort_general(first, last, comp, temp_buf);
+                return;
+            }
+        }
         insertion_sort(first, last, comp);
+    }
 }
 SORTER_END
 #endif // SMALL_SORT_H_INCLUDED
@@ -5,6 +5,11 @@
 #include <type_traits>
 #include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
 #define SORTER_BEGIN namespace sorter {
 #define SORTER_END }
 
@@ -20,16 +25,93 @@
 #define INLINE_VAR
 #endif //C++17
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SORTER_FORCEINLINE __forceinline
+#else
+#define SORTER_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+// Selects the branch taken during constant evaluation, where the stack scratch buffers,
+// placement new and std::inplace_merge cannot be used.
+#if defined(__cpp_if_consteval)
+#define SORTER_IF_CONSTEVAL if consteval
+#else
+#define SORTER_IF_CONSTEVAL if (std::is_constant_evaluated())
+#endif
+
+// Optimizer hint only; never evaluated, and skipped during constant evaluation.
+#if defined(__clang__)
+#define SORTER_ASSUME(cond) do { if (!std::is_constant_evaluated()) __builtin_assume(cond); } while (0)
+#elif defined(_MSC_VER)
+#define SORTER_ASSUME(cond) do { if (!std::is_constant_evaluated()) __assume(cond); } while (0)
+#elif defined(__GNUC__) && __GNUC__ >= 13
+#define SORTER_ASSUME(cond) __attribute__((assume(cond)))
+#else
+#define SORTER_ASSUME(cond) ((void)0)
+#endif
+
+// Read prefetch hint for the cache line holding 'addr'; never faults.
+#if defined(__GNUC__) || defined(__clang__)
+#define SORTER_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define SORTER_PREFETCH(addr) ((void)(addr))
+#endif
+
 SORTER_BEGIN
-INLINE_VAR constexpr size_t MAX_STACK_SIZE = 4096; // default to ~1 page
 INLINE_VAR constexpr int BATCH = 8;
 INLINE_VAR constexpr int BITONIC_BATCH = 16;
-INLINE_VAR constexpr int SSORT_MAX  = 32;
-INLINE_VAR constexpr int BLOCK_SIZE = 64;
-INLINE_VAR constexpr int PSEUDO_MEDIAN_REC_THRESHOLD = 64;
-INLINE_VAR constexpr int SMALL_SORT_GENERAL_SCRATCH_LEN = 48;
-INLINE_VAR constexpr int SMALL_SORT_NETWORK_SCRATCH_LEN = 32;
-// INLINE_VAR constexpr size_t MAX_BRANCHLESS_SIZE = 96;
+INLINE_VAR constexpr int SMALL_SORT_NETWORK_SCRATCH_LEN = 2 * BITONIC_BATCH; // longest network sort
+
+// Tuning parameters of the sort. The best values depend on the CPU and on the size of the
+// elements, so they are looked up per element size through sort_config, which can be
+// specialized by hand or by a header generated with tools/autotune (see below).
+struct sort_tuning
+{
+    size_t max_stack_size;           // largest small-sort scratch buffer kept on the stack
+    int ssort_max;                   // ranges up to this length go to small_sort; 8 to 32
+    int block_size;                  // elements per bitset_partition block; 1 to 64
+    int pseudo_median_rec_threshold; // ranges from this length take the recursive pivot sample
+    ptrdiff_t dual_pivot_threshold;  // ranges from this length use the dual-pivot partition (without bitset_partition)
+    size_t max_network_size;         // largest trivial type sorted by the sorting networks
+};
+
+INLINE_VAR constexpr sort_tuning default_sort_tuning = {
+    4096,               // ~1 page
+    32,
+    64,
+    64,
+    1 << 16,
+    4 * sizeof(size_t)
+};
+
+template <size_t TypeSize>
+struct sort_config
+{
+    static constexpr sort_tuning tuning = default_sort_tuning;
+};
+SORTER_END
+
+// -DSORTER_TUNING_HEADER='"tuned.h"' includes sort_config specializations, e.g. the output
+// of tools/autotune.
+#ifdef SORTER_TUNING_HEADER
+#include SORTER_TUNING_HEADER
+#endif
+
+SORTER_BEGIN
+template <class Tp>
+struct tuning_of
+{
+    static constexpr sort_tuning value = sort_config<sizeof(Tp)>::tuning;
+    static_assert(value.ssort_max >= BATCH && value.ssort_max <= SMALL_SORT_NETWORK_SCRATCH_LEN,
+                  "ssort_max must be within [8, 32]");
+    static_assert(value.block_size >= 1 && value.block_size <= 64, "block_size must be within [1, 64]");
+    static_assert(value.pseudo_median_rec_threshold >= 8, "pseudo_median_rec_threshold must be at least 8");
+    static_assert(value.dual_pivot_threshold >= 256, "dual_pivot_threshold must be at least 256");
+};
+
+// small_sort_general needs 16 elements of scratch beyond the range.
+template <class Tp>
+INLINE_VAR constexpr int small_sort_general_scratch_len = tuning_of<Tp>::value.ssort_max + 16;
 
 template <class Tp>
 struct is_simple_comparator : std::false_type {};
@@ -44,6 +126,16 @@ template <>
 struct is_simple_comparator<std::ranges::greater> : std::true_type {};
 #endif // C++20
 
+// The simple comparators which sort in descending order.
+template <class Compare>
+INLINE_VAR constexpr bool is_greater_comparator = false;
+template <class Tp>
+INLINE_VAR constexpr bool is_greater_comparator<std::greater<Tp>> = true;
+#if __cplusplus > 201703L
+template <>
+INLINE_VAR constexpr bool is_greater_comparator<std::ranges::greater> = true;
+#endif // C++20
+
 template <class Iter,
           class Compare,
           class Tp = typename std::iterator_traits<Iter>::value_type>
@@ -56,36 +148,147 @@ template <class Iter,
           class Tp = typename std::iterator_traits<Iter>::value_type>
 constexpr bool use_sorting_network = std::is_trivially_copy_constructible<Tp>::value &&
                                      std::is_trivially_copy_assignable<Tp>::value &&
-                                     sizeof(Tp) <= 4 * sizeof(size_t) &&
+                                     sizeof(Tp) <= tuning_of<Tp>::value.max_network_size &&
                                      is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+// Comparators may also provide a batch form of comp(*it, pivot), which bitset_partition
+// then uses for its blocks, e.g. to compare many rows at once with SIMD or JIT code:
+//
+//     uint64_t compare_block(Iter first, int count, const value_type& pivot);
+//
+// Bit j of the result is comp(first[j], pivot), for 0 < count <= 64; higher bits are
+// ignored.
+template <class Compare,
+          class Iter,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool has_compare_block = requires(Compare& comp, Iter it, const Tp& pivot) {
+    { comp.compare_block(it, 64, pivot) } -> std::convertible_to<uint64_t>;
+};
+
+// Arithmetic types with the simple comparators, and comparators with compare_block.
+template <class Iter,
+          class Compare>
+constexpr bool use_bitset_partition = use_branchless_sort<Iter, Compare> ||
+                                      has_compare_block<typename std::remove_cvref<Compare>::type, Iter>;
+
+// Prefetches what an element points to. Defined for object pointers, std::unique_ptr and
+// std::shared_ptr; other handles (e.g. indices into a table) opt in with an overload
+// found by argument-dependent lookup.
+template <class Tp>
+    requires std::is_object<Tp>::value
+SORTER_FORCEINLINE void
+prefetch_target(Tp* ptr) noexcept
+{ SORTER_PREFETCH(ptr); }
+
+template <class Tp,
+          class Deleter>
+SORTER_FORCEINLINE void
+prefetch_target(const std::unique_ptr<Tp, Deleter>& ptr) noexcept
+{ SORTER_PREFETCH(std::to_address(ptr.get())); }
+
+template <class Tp>
+SORTER_FORCEINLINE void
+prefetch_target(const std::shared_ptr<Tp>& ptr) noexcept
+{ SORTER_PREFETCH(ptr.get()); }
+
+// Elements with a prefetch_target under a comparator that may follow them, which the
+// scans of the partitions and small sorts then prefetch ahead of their comparisons. The
+// simple comparators compare the pointers themselves.
+template <class Iter,
+          class Compare,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool use_target_prefetch = requires(const Tp& value) { prefetch_target(value); } &&
+                                     !is_simple_comparator<typename std::remove_cvref<Compare>::type>::value;
+
+// Prefetches the target of *it if use_target_prefetch; nothing otherwise.
+template <class Compare,
+          class Iter>
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
+prefetch_element_target(Iter it) noexcept
+{
+    if constexpr (use_target_prefetch<Iter, Compare>)
+        if (!std::is_constant_evaluated())
+            prefetch_target(*it);
+}
+
+// Prefetches the targets of the first (up to) 64 elements of [first, last) at once, so
+// that a small sort overlaps their misses instead of taking them one comparison at a time.
+template <class Compare,
+          class Iter>
+CONSTEXPR_CPP20 SORTER_FORCEINLINE void
+prefetch_element_targets(Iter first,
+                         Iter last) noexcept
+{
+    if constexpr (use_target_prefetch<Iter, Compare> &&
+                  std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<Iter>::iterator_category>::value)
+        if (!std::is_constant_evaluated())
+            for (Iter it = first, end = first + std::min<std::ptrdiff_t>(last - first, 64); it != end; ++it)
+                prefetch_target(*it);
+}
+
+// Reverses the order of the bits of 'x'.
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
+uint64_t reverse_bits(uint64_t x) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    x = __builtin_bswap64(x);
+#else
+    x = (x >> 32) | (x << 32);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+    x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+#endif
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    return x;
+}
+
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 unsigned clear_lowest_bit(unsigned x) noexcept { return x & (x - 1); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 unsigned long clear_lowest_bit(unsigned long x) noexcept { return x & (x - 1); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 unsigned long long clear_lowest_bit(unsigned long long x) noexcept { return x & (x - 1); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_tail_zero(unsigned x) noexcept { return __builtin_ctz(x); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_tail_zero(unsigned long x) noexcept { return __builtin_ctzl(x); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_tail_zero(unsigned long long x) noexcept { return __builtin_ctzll(x); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_left_zero(unsigned x) noexcept { return __builtin_clz(x); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_left_zero(unsigned long x) noexcept { return __builtin_clzl(x); }
 
-[[nodiscard]] CONSTEXPR_CPP20 __forceinline
+[[nodiscard]] CONSTEXPR_CPP20 SORTER_FORCEINLINE
 int count_left_zero(unsigned long long x) noexcept { return __builtin_clzll(x); }
 
+template <class Tp>
+inline constexpr Tp log2i(Tp val) noexcept
+{
+#if __cplusplus >= 201703L
+    return std::bit_width(std::make_unsigned_t<Tp>(val)) - 1;
+#else
+    const int sz = sizeof(+val);
+    int w = sz * __CHAR_BIT__ - 1;
+    if (sz == sizeof(long long))
+        w -= __builtin_clzll(+val);
+    else if (sz == sizeof(long))
+        w -= __builtin_clzl(+val);
+    else if (sz == sizeof(int))
+        w -= __builtin_clz(+val);
+    return w;
+#endif
+}
+
 template <class BidirectionalIterator>
 CONSTEXPR_CPP20 inline
 BidirectionalIterator
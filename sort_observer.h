@@ -0,0 +1,75 @@
+#ifndef SORT_OBSERVER_H_INCLUDED
+#define SORT_OBSERVER_H_INCLUDED
+#include "sort_aux.h"
+#include <chrono>
+
+SORTER_BEGIN
+enum class sort_event : int
+{
+    run_detection,  // rank = length of the leading run
+    partition,      // rank = final position of the pivot, kernel = partition used
+    equal_elements, // rank = number of elements equal to the pivot
+    small_sort,
+    heap_fallback,
+    merge           // rank = length of the sorted prefix merged with the tail
+};
+
+enum class partition_kernel : int
+{
+    none,
+    bitset,
+    fulcrum,
+    three_way,
+    dual_pivot,  // rank = final position of the smaller pivot
+    distribution, // rank = number of buckets
+    counting      // rank = number of histogram slots
+};
+
+typedef std::chrono::steady_clock observer_clock;
+
+struct sort_event_info
+{
+    sort_event event;
+    std::ptrdiff_t size;
+    std::ptrdiff_t rank;
+    partition_kernel kernel;
+    observer_clock::time_point start;
+    observer_clock::time_point stop;
+};
+
+// The default observer. Every hook is compiled out for it, including reading the clock.
+struct null_observer
+{
+    constexpr void operator()(const sort_event_info&) const noexcept {}
+};
+
+template <class Observer>
+constexpr bool is_null_observer = std::is_same<typename std::remove_cvref<Observer>::type, null_observer>::value;
+
+struct observer_no_time {};
+
+template <class Observer>
+CONSTEXPR_CPP20 inline auto
+observe_start(Observer&) noexcept
+{
+    if constexpr (is_null_observer<Observer>)
+        return observer_no_time{};
+    else
+        return observer_clock::now();
+}
+
+template <class Observer,
+          class TimePoint>
+CONSTEXPR_CPP20 inline void
+observe(Observer& obs,
+        TimePoint start,
+        sort_event event,
+        std::ptrdiff_t size,
+        std::ptrdiff_t rank = -1,
+        partition_kernel kernel = partition_kernel::none)
+{
+    if constexpr (!is_null_observer<Observer>)
+        obs(sort_event_info{event, size, rank, kernel, start, observer_clock::now()});
+}
+SORTER_END
+#endif // SORT_OBSERVER_H_INCLUDED
@@ -0,0 +1,270 @@
+#ifndef STREAM_SORT_H_INCLUDED
+#define STREAM_SORT_H_INCLUDED
+#include "qsort.h"
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if __has_include(<unistd.h>)
+#include <cerrno>
+#include <unistd.h>
+#define SORTER_HAS_POSIX_READ 1
+#endif
+
+SORTER_BEGIN
+INLINE_VAR constexpr size_t STREAM_CHUNK_LEN = size_t(1) << 16;
+
+// Sorts records while they are still arriving. Every filled chunk is handed to a
+// background thread which sorts it with qsort, so that by the end of the stream only
+// the last partial chunk and the final k-way merge of the runs are left to do.
+template <class Tp,
+          class Compare = std::less<Tp>>
+class stream_sorter
+{
+public:
+    typedef Tp value_type;
+
+    explicit stream_sorter(size_t chunk_len = STREAM_CHUNK_LEN, Compare comp = Compare{})
+        : chunk_len_(chunk_len ? chunk_len : 1), comp_(comp)
+    {
+        chunk_.reserve(chunk_len_);
+        worker_ = std::thread([this] { run_worker(); });
+    }
+
+    stream_sorter(const stream_sorter&) = delete;
+    stream_sorter& operator=(const stream_sorter&) = delete;
+
+    ~stream_sorter()
+    { stop_worker(); }
+
+    void push(const value_type& value)
+    {
+        if (filled_ < chunk_.size()) // the chunk was sized for raw input
+            chunk_[filled_] = value;
+        else
+            chunk_.push_back(value);
+        if (++filled_ == chunk_len_)
+            seal_chunk();
+    }
+
+    void push(value_type&& value)
+    {
+        if (filled_ < chunk_.size())
+            chunk_[filled_] = std::move(value);
+        else
+            chunk_.push_back(std::move(value));
+        if (++filled_ == chunk_len_)
+            seal_chunk();
+    }
+
+    template <class InputIterator>
+    void push(InputIterator first, InputIterator last)
+    {
+        for (; first != last; ++first)
+            push(*first);
+    }
+
+    // Reads raw records until end of stream. A trailing partial record is kept and
+    // completed by the next read; see partial_bytes. Returns the number of bytes consumed.
+    size_t read_from(std::istream& in)
+    {
+        size_t total = 0;
+        while (in)
+        {
+            const size_t capacity = raw_capacity();
+            char* dst = begin_raw_fill();
+            in.read(dst, static_cast<std::streamsize>(capacity));
+            const size_t got = static_cast<size_t>(in.gcount());
+            end_raw_fill(got);
+            total += got;
+        }
+        return total;
+    }
+
+#ifdef SORTER_HAS_POSIX_READ
+    // Same as above for a file descriptor (pipe, socket or file). Returns the number of
+    // bytes consumed, or -1 if read(2) failed; the records read so far are kept.
+    ptrdiff_t read_from(int fd)
+    {
+        ptrdiff_t total = 0;
+        for (;;)
+        {
+            const size_t capacity = raw_capacity();
+            char* dst = begin_raw_fill();
+            const ssize_t got = ::read(fd, dst, capacity);
+            if (got < 0 && errno == EINTR)
+            {
+                end_raw_fill(0);
+                continue;
+            }
+            end_raw_fill(got > 0 ? static_cast<size_t>(got) : 0);
+            if (got <= 0)
+                return got < 0 ? -1 : total;
+            total += got;
+        }
+    }
+#endif // SORTER_HAS_POSIX_READ
+
+    // Bytes of an unfinished record left by the last raw read, which no record has
+    // completed yet; nonzero at the end of input means the stream was truncated.
+    size_t partial_bytes() const noexcept
+    { return partial_bytes_; }
+
+    // Waits for the background sorts, sorts the last chunk and merges all runs into
+    // dest. The sorter is empty afterwards and may be reused. A trailing partial record
+    // is dropped: check partial_bytes() first to detect a truncated stream.
+    template <class OutputIterator>
+    OutputIterator finish(OutputIterator dest)
+    {
+        chunk_.resize(filled_);
+        if (!chunk_.empty())
+        {
+            qsort(chunk_.begin(), chunk_.end(), comp_);
+            std::unique_lock<std::mutex> lock(mutex_);
+            sorted_.push_back(std::move(chunk_));
+        }
+        chunk_.clear();
+        chunk_.reserve(chunk_len_);
+        filled_ = 0;
+        partial_bytes_ = 0;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return pending_.empty() && !busy_; });
+        std::vector<std::vector<value_type>> runs(std::move(sorted_));
+        sorted_.clear();
+        lock.unlock();
+        return merge_runs(runs, dest);
+    }
+
+    std::vector<value_type> finish()
+    {
+        std::vector<value_type> out;
+        finish(std::back_inserter(out));
+        return out;
+    }
+
+private:
+    size_t raw_capacity() const
+    { return (chunk_len_ - filled_) * sizeof(value_type) - partial_bytes_; }
+
+    // Exposes the free tail of the current chunk as bytes, restoring the bytes of an
+    // unfinished record left by the previous read in front of it. The chunk is sized to
+    // chunk_len_ by the first read into it only, so that the later reads do not
+    // initialize its tail again.
+    char* begin_raw_fill()
+    {
+        static_assert(std::is_trivially_copyable<value_type>::value &&
+                      std::is_default_constructible<value_type>::value,
+                      "raw stream input requires a trivially copyable value_type");
+        if (chunk_.size() != chunk_len_)
+            chunk_.resize(chunk_len_);
+        char* dst = reinterpret_cast<char*>(chunk_.data() + filled_);
+        std::memcpy(dst, partial_, partial_bytes_);
+        return dst + partial_bytes_;
+    }
+
+    void end_raw_fill(size_t got)
+    {
+        const size_t bytes    = partial_bytes_ + got;
+        const size_t complete = bytes / sizeof(value_type);
+        partial_bytes_ = bytes % sizeof(value_type);
+        filled_ += complete;
+        std::memcpy(partial_, chunk_.data() + filled_, partial_bytes_);
+        if (filled_ == chunk_len_)
+            seal_chunk();
+    }
+
+    void seal_chunk()
+    {
+        chunk_.resize(filled_);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            pending_.push_back(std::move(chunk_));
+        }
+        wake_.notify_one();
+        chunk_ = std::vector<value_type>();
+        chunk_.reserve(chunk_len_);
+        filled_ = 0;
+    }
+
+    void run_worker()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            wake_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            if (stop_)
+                return;
+            std::vector<value_type> run(std::move(pending_.front()));
+            pending_.pop_front();
+            busy_ = true;
+            lock.unlock();
+            qsort(run.begin(), run.end(), comp_);
+            lock.lock();
+            sorted_.push_back(std::move(run));
+            busy_ = false;
+            if (pending_.empty())
+                idle_.notify_all();
+        }
+    }
+
+    void stop_worker()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+
+    template <class OutputIterator>
+    OutputIterator merge_runs(std::vector<std::vector<value_type>>& runs, OutputIterator dest)
+    {
+        typedef typename std::vector<value_type>::iterator run_iterator;
+        std::vector<std::pair<run_iterator, run_iterator>> heap;
+        heap.reserve(runs.size());
+        for (std::vector<value_type>& run : runs)
+            if (!run.empty())
+                heap.emplace_back(run.begin(), run.end());
+        // min-heap on the head of each run; ties keep no particular order.
+        auto heap_comp = [this](const std::pair<run_iterator, run_iterator>& a,
+                                const std::pair<run_iterator, run_iterator>& b)
+        { return comp_(*b.first, *a.first); };
+        std::make_heap(heap.begin(), heap.end(), heap_comp);
+        while (heap.size() > 1)
+        {
+            std::pop_heap(heap.begin(), heap.end(), heap_comp);
+            std::pair<run_iterator, run_iterator>& top = heap.back();
+            *dest = std::move(*top.first);
+            ++dest;
+            if (++top.first == top.second)
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), heap_comp);
+        }
+        if (!heap.empty())
+            dest = std::move(heap.front().first, heap.front().second, dest);
+        return dest;
+    }
+
+    const size_t chunk_len_;
+    Compare comp_;
+    std::vector<value_type> chunk_;
+    size_t filled_ = 0; // records in chunk_, which may be longer during raw input
+    size_t partial_bytes_ = 0;
+    alignas(value_type) char partial_[sizeof(value_type)];
+    std::deque<std::vector<value_type>> pending_;
+    std::vector<std::vector<value_type>> sorted_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::thread worker_;
+};
+SORTER_END
+#endif // STREAM_SORT_H_INCLUDED
@@ -0,0 +1,177 @@
+// Measures qsort on inputs crafted against it, next to random input of the same size.
+//
+//     c++ -std=c++20 -O2 -I. tools/adversarial/adversarial.cpp -o adversarial
+//     ./adversarial [log2 of the length, 20 by default]
+//
+// The elements are indices sorted by a key array, so that every comparison goes through
+// the comparator. Besides the usual patterns, the keys of the "antiqsort" rows come from
+// McIlroy's adversary ("A Killer Adversary for Quicksort", 1999): the sort is first run
+// with a comparator which fixes the keys lazily, so that each partition gets as little as
+// possible, and the keys it fixed are then sorted for real. Since the adversary adapts to
+// every comparison, it defeats any deterministic pivot choice, pattern breaking
+// included; what bounds it is the heap_sort fallback. With a pivot_seed it does not know,
+// the crafted keys sort like random ones. For each input the time, the number of
+// comparisons and the elements left to heap_sort are printed, with the times relative to
+// random input.
+#include "qsort.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct fallback_counter
+{
+    long long heap_elements = 0;
+
+    void operator()(const sorter::sort_event_info& info) noexcept
+    {
+        if (info.event == sorter::sort_event::heap_fallback)
+            heap_elements += info.size;
+    }
+};
+
+// McIlroy's adversary: every key starts as 'gas', larger than any fixed key. When two
+// gas keys are compared, one is fixed to the next smallest value; the gas key compared
+// last is preferred as the survivor, since it is likely the pivot.
+struct gas_adversary
+{
+    std::vector<int>* keys;
+    int* fixed;
+    int* candidate;
+    int gas;
+
+    bool operator()(int x, int y) const
+    {
+        std::vector<int>& k = *keys;
+        if (k[x] == gas && k[y] == gas)
+            k[x == *candidate ? x : y] = (*fixed)++;
+        if (k[x] == gas)
+            *candidate = x;
+        else if (k[y] == gas)
+            *candidate = y;
+        return k[x] < k[y];
+    }
+};
+
+// Keys against qsort, or against qsort seeded with 'seed' if not negative. The first two
+// are fixed as a descending pair, so that the run detection gives up at once and the
+// adversary plays against the partitions.
+std::vector<int> antiqsort_keys(int len,
+                                long long seed)
+{
+    std::vector<int> keys(len, len + 1);
+    keys[0] = len;
+    keys[1] = 0;
+    int fixed = 1;
+    int candidate = 0;
+    std::vector<int> indices(len);
+    std::iota(indices.begin(), indices.end(), 0);
+    const gas_adversary comp{&keys, &fixed, &candidate, len + 1};
+    if (seed < 0)
+        sorter::qsort(indices.begin(), indices.end(), comp);
+    else
+        sorter::qsort(indices.begin(), indices.end(), comp, sorter::pivot_seed{static_cast<uint64_t>(seed)});
+    return keys;
+}
+
+struct result
+{
+    double millis;
+    long long comparisons;
+    long long heap_elements;
+};
+
+result measure(const std::vector<int>& keys,
+               long long seed)
+{
+    std::vector<int> indices(keys.size());
+    long long comparisons = 0;
+    fallback_counter counter;
+    auto comp = [&keys, &comparisons](int a, int b) {
+        ++comparisons;
+        return keys[a] < keys[b];
+    };
+    double best = 1e300;
+    for (int rep = 0; rep < 3; ++rep)
+    {
+        std::iota(indices.begin(), indices.end(), 0);
+        comparisons = 0;
+        counter = fallback_counter{};
+        const auto start = std::chrono::steady_clock::now();
+        if (seed < 0)
+            sorter::qsort(indices.begin(), indices.end(), comp, counter);
+        else
+            sorter::qsort(indices.begin(), indices.end(), comp, sorter::pivot_seed{static_cast<uint64_t>(seed)}, counter);
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    for (size_t i = 1; i < indices.size(); ++i)
+    {
+        if (keys[indices[i]] < keys[indices[i - 1]])
+        {
+            std::fprintf(stderr, "not sorted\n");
+            std::exit(1);
+        }
+    }
+    return result{best, comparisons, counter.heap_elements};
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const int log_len = argc > 1 ? std::atoi(argv[1]) : 20;
+    if (log_len < 4 || log_len > 28)
+    {
+        std::fprintf(stderr, "usage: %s [log2 of the length, 4 to 28]\n", argv[0]);
+        return 2;
+    }
+    const int len = 1 << log_len;
+    const long long seed = 0x5eed;
+    std::mt19937 rng(1);
+
+    struct input
+    {
+        std::string name;
+        std::vector<int> keys;
+        long long seed;
+    };
+    std::vector<input> inputs;
+    std::vector<int> keys(len);
+    for (int& k : keys)
+        k = static_cast<int>(rng());
+    inputs.push_back({"random", keys, -1});
+    inputs.push_back({"random, seeded", keys, seed});
+    std::iota(keys.begin(), keys.end(), 0);
+    inputs.push_back({"ascending", keys, -1});
+    std::reverse(keys.begin(), keys.end());
+    inputs.push_back({"descending", keys, -1});
+    for (int i = 0; i < len; ++i)
+        keys[i] = std::min(i, len - i);
+    inputs.push_back({"organ pipe", keys, -1});
+    for (int i = 0; i < len; ++i)
+        keys[i] = i % (1 << (log_len / 2));
+    inputs.push_back({"sawtooth", keys, -1});
+    for (int i = 0; i < len; ++i)
+        keys[i] = (i & 1) ? i : len - i; // interleaved runs
+    inputs.push_back({"interleaved", keys, -1});
+    const std::vector<int> crafted = antiqsort_keys(len, -1);
+    inputs.push_back({"antiqsort", crafted, -1});
+    inputs.push_back({"antiqsort, seeded", crafted, seed});
+    inputs.push_back({"antiqsort for the seed", antiqsort_keys(len, seed), seed});
+
+    std::printf("%d elements\n%-24s %10s %8s %14s %12s\n", len, "input", "ms", "x random", "comparisons", "heap_sort");
+    double random_millis = 0;
+    for (const input& in : inputs)
+    {
+        const result r = measure(in.keys, in.seed);
+        if (in.name == "random")
+            random_millis = r.millis;
+        std::printf("%-24s %10.2f %8.2f %14lld %12lld\n", in.name.c_str(), r.millis, r.millis / random_millis,
+                    r.comparisons, r.heap_elements);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Picks the sort_tuning values for the local machine and writes them as sort_config
+// specializations, to be used with -DSORTER_TUNING_HEADER='"sorter_tuning.h"'.
+//
+//     c++ -std=c++20 -O2 tools/autotune/autotune.cpp -o autotune
+//     ./autotune [--cxx c++] [--flags "-std=c++20 -O2"] [--root .] [--out sorter_tuning.h]
+//
+// For each element size (4, 8, 16 and 32 bytes) every field is tuned in turn, keeping
+// the best value found so far for the others: each candidate configuration is compiled
+// into tools/autotune/autotune_bench.cpp and timed. Pass the flags of the production
+// build, so the candidates are measured with the same code generation. POSIX only.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct tuning
+{
+    long long max_stack_size = 4096;
+    long long ssort_max = 32;
+    long long block_size = 64;
+    long long pseudo_median_rec_threshold = 64;
+    long long dual_pivot_threshold = 1 << 16;
+    long long max_network_size = 4 * sizeof(size_t);
+};
+
+struct field
+{
+    const char* name;
+    long long tuning::* member;
+    std::vector<long long> candidates;
+};
+
+struct options
+{
+    std::string cxx   = "c++";
+    std::string flags = "-std=c++20 -O2";
+    std::string root  = ".";
+    std::string out   = "sorter_tuning.h";
+};
+
+std::string initializer(const tuning& t)
+{
+    return "{" + std::to_string(t.max_stack_size) + ", " + std::to_string(t.ssort_max) + ", " +
+           std::to_string(t.block_size) + ", " + std::to_string(t.pseudo_median_rec_threshold) + ", " +
+           std::to_string(t.dual_pivot_threshold) + ", " + std::to_string(t.max_network_size) + "}";
+}
+
+std::string specialization(int type_size, const tuning& t)
+{
+    return "template <>\nstruct sort_config<" + std::to_string(type_size) + ">\n{\n"
+           "    // max_stack_size, ssort_max, block_size, pseudo_median_rec_threshold,\n"
+           "    // dual_pivot_threshold, max_network_size\n"
+           "    static constexpr sort_tuning tuning = " + initializer(t) + ";\n};\n";
+}
+
+// Returns the benchmark time in microseconds, or a negative value on failure.
+double measure(const options& opt,
+               const std::filesystem::path& dir,
+               int type_size,
+               const tuning& t)
+{
+    const std::filesystem::path header = dir / "candidate.h";
+    const std::filesystem::path binary = dir / "bench";
+    {
+        std::ofstream out(header);
+        out << "SORTER_BEGIN\n" << specialization(type_size, t) << "SORTER_END\n";
+    }
+    const std::string compile = opt.cxx + " " + opt.flags + " -I\"" + opt.root + "\"" +
+                                " -DAUTOTUNE_TYPE_SIZE=" + std::to_string(type_size) +
+                                " -DSORTER_TUNING_HEADER='\"" + header.string() + "\"'" +
+                                " \"" + opt.root + "/tools/autotune/autotune_bench.cpp\" -o \"" + binary.string() + "\"";
+    if (std::system(compile.c_str()) != 0)
+        return -1;
+    FILE* pipe = ::popen(("\"" + binary.string() + "\"").c_str(), "r");
+    if (pipe == nullptr)
+        return -1;
+    double micros = -1;
+    if (std::fscanf(pipe, "%lf", &micros) != 1)
+        micros = -1;
+    ::pclose(pipe);
+    return micros;
+}
+
+tuning tune(const options& opt,
+            const std::filesystem::path& dir,
+            int type_size)
+{
+    const std::vector<field> fields = {
+        {"ssort_max", &tuning::ssort_max, {16, 20, 24, 28, 32}},
+        // whether the small_sort_general scratch (ssort_max + 16 elements) lives on the
+        // stack; without it, and without an active arena, small sorts take insertion_sort.
+        // 1024 keeps it for the 16-byte records only, 0 for none.
+        {"max_stack_size", &tuning::max_stack_size, {0, 1024, 4096}},
+        {"block_size", &tuning::block_size, {32, 48, 64}},
+        {"pseudo_median_rec_threshold", &tuning::pseudo_median_rec_threshold, {32, 64, 128, 256}},
+        {"dual_pivot_threshold", &tuning::dual_pivot_threshold, {1 << 14, 1 << 16, 1 << 18, 1 << 30}},
+        // 'type_size - 1' turns the sorting networks off for this size.
+        {"max_network_size", &tuning::max_network_size, {type_size - 1, 4 * static_cast<long long>(sizeof(size_t))}},
+    };
+    tuning best;
+    double best_time = measure(opt, dir, type_size, best);
+    std::fprintf(stderr, "size %2d: defaults %.0f us\n", type_size, best_time);
+    if (best_time < 0)
+        return best;
+    for (const field& f : fields)
+    {
+        for (long long value : f.candidates)
+        {
+            if (value == best.*f.member)
+                continue;
+            tuning candidate = best;
+            candidate.*f.member = value;
+            const double time = measure(opt, dir, type_size, candidate);
+            std::fprintf(stderr, "size %2d: %s = %lld: %.0f us\n", type_size, f.name, value, time);
+            if (time >= 0 && time < best_time)
+            {
+                best = candidate;
+                best_time = time;
+            }
+        }
+    }
+    std::fprintf(stderr, "size %2d: best %s, %.0f us\n", type_size, initializer(best).c_str(), best_time);
+    return best;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--cxx")
+            opt.cxx = argv[i + 1];
+        else if (arg == "--flags")
+            opt.flags = argv[i + 1];
+        else if (arg == "--root")
+            opt.root = argv[i + 1];
+        else if (arg == "--out")
+            opt.out = argv[i + 1];
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--cxx c++] [--flags \"-std=c++20 -O2\"] [--root .] [--out sorter_tuning.h]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "sorter_autotune";
+    std::filesystem::create_directories(dir);
+    std::string body;
+    for (int type_size : {4, 8, 16, 32})
+        body += "\n" + specialization(type_size, tune(opt, dir, type_size));
+    std::filesystem::remove_all(dir);
+
+    std::ofstream out(opt.out);
+    out << "// Generated by tools/autotune with: " << opt.cxx << " " << opt.flags << "\n"
+        << "// Include with -DSORTER_TUNING_HEADER='\"" << opt.out << "\"'.\n"
+        << "SORTER_BEGIN" << body << "SORTER_END\n";
+    std::fprintf(stderr, "wrote %s\n", opt.out.c_str());
+    return 0;
+}
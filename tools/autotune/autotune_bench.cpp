@@ -0,0 +1,83 @@
+// Benchmark run by autotune for one candidate configuration. Build with
+// -DAUTOTUNE_TYPE_SIZE=<4|8|16|32> and -DSORTER_TUNING_HEADER='"candidate.h"'; prints the
+// best time in microseconds over a fixed mix of inputs.
+#include "qsort.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#ifndef AUTOTUNE_TYPE_SIZE
+#define AUTOTUNE_TYPE_SIZE 8
+#endif
+
+template <size_t Size>
+struct record
+{
+    uint64_t key;
+    unsigned char payload[Size - sizeof(uint64_t)];
+
+    friend bool operator<(const record& left, const record& right) noexcept
+    { return left.key < right.key; }
+};
+
+#if AUTOTUNE_TYPE_SIZE == 4
+typedef uint32_t element;
+#elif AUTOTUNE_TYPE_SIZE == 8
+typedef uint64_t element;
+#else
+typedef record<AUTOTUNE_TYPE_SIZE> element;
+#endif
+static_assert(sizeof(element) == AUTOTUNE_TYPE_SIZE, "unsupported AUTOTUNE_TYPE_SIZE");
+
+// a template, so that the branch for the other kind of element is discarded
+template <class Tp = element>
+static Tp make_element(uint64_t key)
+{
+    Tp val{};
+    if constexpr (std::is_arithmetic<Tp>::value)
+        val = static_cast<Tp>(key);
+    else
+        val.key = key;
+    return val;
+}
+
+int main()
+{
+    std::mt19937_64 rng(42);
+    const size_t len = 1 << 20;
+    std::vector<std::vector<element>> inputs;
+    std::vector<element> input(len);
+    for (element& val : input) // random
+        val = make_element(rng());
+    inputs.push_back(input);
+    for (element& val : input) // few distinct keys
+        val = make_element(rng() % 1000);
+    inputs.push_back(input);
+    for (size_t i = 0; i < len; ++i) // mostly sorted
+        input[i] = make_element(rng() % 100 == 0 ? rng() : i);
+    inputs.push_back(input);
+
+    std::vector<element> work;
+    double best = 1e300;
+    for (int round = 0; round < 5; ++round)
+    {
+        double total = 0;
+        for (const std::vector<element>& in : inputs)
+        {
+            work = in;
+            auto start = std::chrono::steady_clock::now();
+            sorter::qsort(work.begin(), work.end(), std::less<element>{});
+            total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            // many short sorts weigh the small-sort thresholds
+            work = in;
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i + 256 <= len; i += 256)
+                sorter::qsort(work.begin() + i, work.begin() + i + 256, std::less<element>{});
+            total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        best = std::min(best, total);
+    }
+    std::printf("%.0f\n", best);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#ifndef UPDATE_SORTED_H_INCLUDED
+#define UPDATE_SORTED_H_INCLUDED
+#include "qsort.h"
+#include <vector>
+
+SORTER_BEGIN
+// The first position in the sorted [first, first + len) from which every element is
+// greater than 'key'. Gallops from the end, so a key near the end costs O(log d)
+// comparisons for a distance d.
+template <class Compare,
+          class RandomAccessIterator,
+          class Tp>
+ptrdiff_t
+gallop_upper_bound_from_end(RandomAccessIterator first,
+                            ptrdiff_t len,
+                            const Tp& key,
+                            Compare& comp)
+{
+    // [hi, len) is known to be greater than 'key'
+    ptrdiff_t hi = len;
+    ptrdiff_t lo = 0;
+    for (ptrdiff_t step = 1; step <= hi; step <<= 1)
+    {
+        if (!comp(key, first[hi - step]))
+        {
+            lo = hi - step + 1;
+            break;
+        }
+        hi -= step;
+    }
+    return std::upper_bound(first + lo, first + hi, key, comp) - first;
+}
+
+// Restores the order of [first, last) given the positions of the elements changed since
+// it was sorted: for_each_changed(func) calls func(pos) for each of the 'changed'
+// positions in ascending order. The changed elements are moved out to a buffer while
+// the others are compacted to the front, still sorted; the buffer is sorted and merged
+// back from the end, galloping over the runs of unchanged elements.
+template <class Compare,
+          class RandomAccessIterator,
+          class ForEachChanged>
+void
+update_sorted_positions(RandomAccessIterator first,
+                        RandomAccessIterator last,
+                        Compare& comp,
+                        size_t changed,
+                        ForEachChanged&& for_each_changed)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    const ptrdiff_t len = last - first;
+    scoped_scratch scratch;
+    value_type* const buf = scratch.allocate<value_type>(changed);
+    if (buf == nullptr)
+    {
+        qsort(first, last, comp);
+        return;
+    }
+
+    ptrdiff_t read = 0;
+    ptrdiff_t write = 0;
+    value_type* buf_last = buf;
+    for_each_changed([&](ptrdiff_t pos) {
+        if (write != read)
+            std::move(first + read, first + pos, first + write);
+        write += pos - read;
+        ::new (static_cast<void*>(buf_last)) value_type(std::move(first[pos]));
+        ++buf_last;
+        read = pos + 1;
+    });
+    if (write != read)
+        std::move(first + read, last, first + write);
+    qsort(buf, buf_last, comp);
+
+    // [first, first + kept) holds the unchanged elements, the rest is moved from.
+    ptrdiff_t kept = len - static_cast<ptrdiff_t>(changed);
+    ptrdiff_t out  = len;
+    for (value_type* b = buf_last; b != buf;)
+    {
+        --b;
+        const ptrdiff_t pos = gallop_upper_bound_from_end(first, kept, *b, comp);
+        std::move_backward(first + pos, first + kept, first + out);
+        out -= kept - pos;
+        kept = pos;
+        first[--out] = std::move(*b);
+    }
+    std::destroy(buf, buf_last);
+}
+
+// Re-sorts [first, last), which was sorted before the elements at the given indices
+// were modified, in O(N + m log m) for m indices instead of O(N log N). The indices may
+// repeat and come in any order. Among equal elements, the modified ones end up last.
+template <class RandomAccessIterator,
+          class IndexIterator,
+          class Compare>
+void
+update_sorted(RandomAccessIterator first,
+              RandomAccessIterator last,
+              IndexIterator indices_first,
+              IndexIterator indices_last,
+              Compare comp)
+{
+    if (indices_first == indices_last)
+        return;
+    std::vector<ptrdiff_t> positions;
+    for (; indices_first != indices_last; ++indices_first)
+        positions.push_back(static_cast<ptrdiff_t>(*indices_first));
+    qsort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+    if (positions.size() * 2 > static_cast<size_t>(last - first))
+    {
+        qsort(first, last, comp); // most of the range changed
+        return;
+    }
+    update_sorted_positions(first, last, comp, positions.size(), [&positions](auto&& func) {
+        for (ptrdiff_t pos : positions)
+            func(pos);
+    });
+}
+
+template <class RandomAccessIterator,
+          class IndexIterator>
+inline void
+update_sorted(RandomAccessIterator first,
+              RandomAccessIterator last,
+              IndexIterator indices_first,
+              IndexIterator indices_last)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    update_sorted(first, last, indices_first, indices_last, std::less<value_type>{});
+}
+
+// As update_sorted, with the modified elements flagged in a bitmap: bit (i % 64) of
+// bitmap[i / 64] is set if first[i] was modified.
+template <class RandomAccessIterator,
+          class Compare>
+void
+update_sorted_bitmap(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     const uint64_t* bitmap,
+                     Compare comp)
+{
+    const ptrdiff_t len = last - first;
+    const ptrdiff_t words = (len + 63) >> 6;
+    const uint64_t tail_mask = (len & 63) != 0 ? (static_cast<uint64_t>(1) << (len & 63)) - 1 : ~static_cast<uint64_t>(0);
+    auto word = [&](ptrdiff_t w) { return w + 1 == words ? bitmap[w] & tail_mask : bitmap[w]; };
+    size_t changed = 0;
+    for (ptrdiff_t w = 0; w < words; ++w)
+        changed += static_cast<size_t>(std::popcount(word(w)));
+    if (changed == 0)
+        return;
+    if (changed * 2 > static_cast<size_t>(len))
+    {
+        qsort(first, last, comp);
+        return;
+    }
+    update_sorted_positions(first, last, comp, changed, [&](auto&& func) {
+        for (ptrdiff_t w = 0; w < words; ++w)
+            for (uint64_t bits = word(w); bits != 0; bits = clear_lowest_bit(bits))
+                func((w << 6) + count_tail_zero(bits));
+    });
+}
+
+template <class RandomAccessIterator>
+inline void
+update_sorted_bitmap(RandomAccessIterator first,
+                     RandomAccessIterator last,
+                     const uint64_t* bitmap)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type value_type;
+    update_sorted_bitmap(first, last, bitmap, std::less<value_type>{});
+}
+SORTER_END
+#endif // UPDATE_SORTED_H_INCLUDED
@@ -0,0 +1,152 @@
+#ifndef WIDE_KEY_H_INCLUDED
+#define WIDE_KEY_H_INCLUDED
+#include "sort_aux.h"
+#include <array>
+#include <cstring>
+
+SORTER_BEGIN
+// Keys too wide for a machine word whose order is that of a sequence of unsigned words,
+// most significant first: byte arrays (UUIDs, hashes) compared lexicographically, and
+// the 128-bit integers where the compiler does not count them as arithmetic (strict
+// -std modes). 'words' is the word sequence of a key, and less(a, b) compares two of
+// them without branches. 'sorting_networks' lets small_sort use the networks, which
+// only pay off for the integers.
+template <class Tp>
+struct wide_key
+{
+    static constexpr bool enabled = false;
+};
+
+// std::array of 9 to 32 unsigned bytes (UUIDs up to SHA-256 digests), as big-endian
+// 64-bit words; the last word is padded with zeros, which keeps the lexicographic order
+// of equal-length keys. Longer arrays sort faster with an early-exit comparison.
+template <class Byte,
+          size_t N>
+    requires((std::is_same<Byte, unsigned char>::value || std::is_same<Byte, std::byte>::value) && N > 8 && N <= 32)
+struct wide_key<std::array<Byte, N>>
+{
+    static constexpr bool enabled = true;
+    static constexpr bool sorting_networks = false;
+    static constexpr size_t word_count = (N + 7) / 8;
+    typedef std::array<uint64_t, word_count> words;
+
+    // The k-th word of 'key'. The last one is read as the 8 bytes ending the key, so that
+    // no load straddles the end nor partially overlaps a store.
+    static constexpr SORTER_FORCEINLINE uint64_t
+    word(const std::array<Byte, N>& key,
+         size_t k) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        if (!std::is_constant_evaluated() && std::endian::native == std::endian::little)
+        {
+            uint64_t w;
+            if (k + 1 < word_count || N % 8 == 0)
+            {
+                std::memcpy(&w, key.data() + 8 * k, 8);
+                return __builtin_bswap64(w);
+            }
+            std::memcpy(&w, key.data() + (N - 8), 8);
+            return __builtin_bswap64(w) << (8 * (8 - N % 8) % 64);
+        }
+#endif
+        uint64_t w = 0;
+        for (size_t b = 8 * k; b < 8 * k + 8; ++b)
+            w = w << 8 | (b < N ? static_cast<uint64_t>(key[b]) : 0);
+        return w;
+    }
+
+    static constexpr SORTER_FORCEINLINE words
+    load(const std::array<Byte, N>& key) noexcept
+    {
+        words w{};
+        for (size_t k = 0; k < word_count; ++k)
+            w[k] = word(key, k);
+        return w;
+    }
+
+    static constexpr SORTER_FORCEINLINE bool
+    less(const words& a,
+         const words& b) noexcept
+    {
+        bool lt = false;
+        for (size_t k = word_count; k-- > 0;)
+            lt = (a[k] < b[k]) | ((a[k] == b[k]) & lt);
+        return lt;
+    }
+};
+
+#if defined(__SIZEOF_INT128__)
+// Named through __extension__, so that -Wpedantic does not warn wherever qsort.h is
+// included.
+__extension__ typedef __int128 sorter_int128;
+__extension__ typedef unsigned __int128 sorter_uint128;
+
+template <class Tp>
+    requires((std::is_same<Tp, sorter_int128>::value || std::is_same<Tp, sorter_uint128>::value) && !std::is_arithmetic<Tp>::value)
+struct wide_key<Tp>
+{
+    static constexpr bool enabled = true;
+    static constexpr bool sorting_networks = true;
+    typedef Tp words;
+
+    static constexpr SORTER_FORCEINLINE words
+    load(const Tp& key) noexcept
+    { return key; }
+
+    static constexpr SORTER_FORCEINLINE bool
+    less(const words& a,
+         const words& b) noexcept
+    { return a < b; }
+};
+#endif // __SIZEOF_INT128__
+
+// Compares wide keys as their words, ascending or descending, and fills the blocks of
+// bitset_partition through compare_block. qsort substitutes it for the simple
+// comparators on wide keys; it may also be passed directly.
+template <class Tp,
+          bool Descending = false>
+struct wide_key_compare
+{
+    typedef wide_key<Tp> key;
+
+    [[nodiscard]] constexpr SORTER_FORCEINLINE bool
+    operator()(const Tp& a,
+               const Tp& b) const noexcept
+    { return Descending ? key::less(key::load(b), key::load(a)) : key::less(key::load(a), key::load(b)); }
+
+    template <class Iter>
+    constexpr uint64_t
+    compare_block(Iter first,
+                  int count,
+                  const Tp& pivot) const noexcept
+    {
+        const typename key::words p = key::load(pivot);
+        uint64_t mask = 0;
+        for (int j = 0; j < count; ++j)
+        {
+            const typename key::words w = key::load(first[j]);
+            mask |= static_cast<uint64_t>(Descending ? key::less(p, w) : key::less(w, p)) << j;
+        }
+        return mask;
+    }
+};
+
+template <class Tp,
+          bool Descending>
+struct is_simple_comparator<wide_key_compare<Tp, Descending>> : std::bool_constant<wide_key<Tp>::sorting_networks> {};
+
+template <class Compare>
+INLINE_VAR constexpr bool is_wide_key_compare = false;
+template <class Tp,
+          bool Descending>
+INLINE_VAR constexpr bool is_wide_key_compare<wide_key_compare<Tp, Descending>> = true;
+
+// qsort sorts wide keys under the other simple comparators with wide_key_compare.
+template <class Iter,
+          class Compare,
+          class Tp = typename std::iterator_traits<Iter>::value_type>
+constexpr bool use_wide_key_compare = wide_key<Tp>::enabled &&
+                                      is_simple_comparator<typename std::remove_cvref<Compare>::type>::value &&
+                                      !is_wide_key_compare<typename std::remove_cvref<Compare>::type>;
+SORTER_END
+#endif // WIDE_KEY_H_INCLUDED